@@ -0,0 +1,652 @@
+/*
+  ==============================================================================
+
+    Micro-benchmark of the auralization engine DSP stages: times each stage
+    separately on synthetic data, sweeping block size, number of source images,
+    number of frequency bands and crossfade state. Reports cost per sample and
+    per block relative to the real-time budget.
+
+  ==============================================================================
+*/
+
+#include "../../Source/AuralizationEngine.h"
+
+#include <complex>
+#include <iostream>
+#include <vector>
+
+// benchmark settings
+struct BenchSettings
+{
+    double sampleRate;
+    int numBlocks; // number of timed blocks per measure
+    int numWarmupBlocks; // number of non-timed blocks run before each measure
+    bool csvOutput;
+    int numWorkerThreads; // source images processing threads
+    DelayLine::Interpolation delayInterpolation; // fractional delay interpolation of reverb and source images stages
+};
+
+// sweep values
+const std::vector<int> blockSizes = { 64, 128, 256, 512, 1024, 2048 };
+const std::vector<int> numSourceImagesValues = { 1, 10, 100, 500, 1000, 2000 };
+const std::vector<int> numFreqBandsValues = { 3, 10 };
+
+//==============================================================================
+// print command line usage
+void printUsage()
+{
+    std::cout << "usage: EvertSE_Bench [options]" << std::endl;
+    std::cout << "  -r  sample rate (default 48000)" << std::endl;
+    std::cout << "  -n  number of timed blocks per measure (default 100)" << std::endl;
+    std::cout << "  -j  number of threads processing source images (default 1)" << std::endl;
+    std::cout << "  -s  stage to run: all, check, delay, filterbank, reverb, binaural, fir, sourceimages (default all)" << std::endl;
+    std::cout << "  --csv  comma separated output" << std::endl;
+    std::cout << "  --ooura-fft  double precision reference FFT instead of SimdFFT in FIR filters / convolvers" << std::endl;
+    std::cout << "  --interpolation  delay interpolation of reverb / sourceimages stages: linear, lagrange3, thiran, sinc (default linear)" << std::endl;
+}
+
+// print table header
+void printHeader( const BenchSettings & settings )
+{
+    if( settings.csvOutput )
+    {
+        std::cout << "stage,blockSize,numSourceImages,numFreqBands,crossfade,nsPerBlock,nsPerSample,budgetPercent" << std::endl;
+        return;
+    }
+    std::cout << String("stage").paddedRight(' ', 52) << String("block").paddedLeft(' ', 6) << String("images").paddedLeft(' ', 8) << String("bands").paddedLeft(' ', 7) << String("xfade").paddedLeft(' ', 7);
+    std::cout << String("us/block").paddedLeft(' ', 12) << String("ns/sample").paddedLeft(' ', 12) << String("% budget").paddedLeft(' ', 11) << std::endl;
+}
+
+// print one measure: elapsed time is the mean duration of one call (i.e. one block) in sec
+void printResult( const BenchSettings & settings, const String & stage, const int blockSize, const int numSourceImages, const int numFreqBands, const bool crossfade, const double elapsed )
+{
+    double nsPerBlock = 1e9 * elapsed;
+    double nsPerSample = nsPerBlock / blockSize;
+    double budgetPercent = 100.0 * elapsed / ( blockSize / settings.sampleRate );
+    
+    String imagesStr = ( numSourceImages > 0 ) ? String(numSourceImages) : String("-");
+    String bandsStr = ( numFreqBands > 0 ) ? String(numFreqBands) : String("-");
+    String crossfadeStr = crossfade ? String("on") : String("off");
+    
+    if( settings.csvOutput )
+    {
+        std::cout << stage << "," << blockSize << "," << imagesStr << "," << bandsStr << "," << crossfadeStr << ",";
+        std::cout << nsPerBlock << "," << nsPerSample << "," << budgetPercent << std::endl;
+        return;
+    }
+    std::cout << stage.paddedRight(' ', 52) << String(blockSize).paddedLeft(' ', 6) << imagesStr.paddedLeft(' ', 8) << bandsStr.paddedLeft(' ', 7) << crossfadeStr.paddedLeft(' ', 7);
+    std::cout << String(nsPerBlock / 1000.0, 2).paddedLeft(' ', 12) << String(nsPerSample, 2).paddedLeft(' ', 12) << String(budgetPercent, 3).paddedLeft(' ', 11) << std::endl;
+}
+
+// fill buffer with white noise (avoids denormals / zero-input shortcuts that would bias timings)
+void fillWithNoise( AudioBuffer<float> & buffer, Random & random )
+{
+    for( int c = 0; c < buffer.getNumChannels(); c++ )
+    {
+        float* data = buffer.getWritePointer(c);
+        for( int i = 0; i < buffer.getNumSamples(); i++ ){ data[i] = 2.f * random.nextFloat() - 1.f; }
+    }
+}
+
+// run process numWarmupBlocks times, then return mean duration (sec) of numBlocks timed runs.
+// prepare is called before each run, outside of the timed region.
+template <typename PrepareFunction, typename ProcessFunction>
+double timeBlocks( const BenchSettings & settings, PrepareFunction prepare, ProcessFunction process )
+{
+    for( int b = 0; b < settings.numWarmupBlocks; b++ ){ prepare(); process(); }
+    
+    int64 elapsedTicks = 0;
+    for( int b = 0; b < settings.numBlocks; b++ )
+    {
+        prepare();
+        int64 startTicks = Time::getHighResolutionTicks();
+        process();
+        elapsedTicks += Time::getHighResolutionTicks() - startTicks;
+    }
+    return Time::highResolutionTicksToSeconds( elapsedTicks ) / settings.numBlocks;
+}
+
+//==============================================================================
+// STAGES
+
+// fractional delay taps of one source image (called once per source image per block by SourceImagesHandler,
+// with 2 taps (old and new delays) during crossfade)
+void benchDelayLine( const BenchSettings & settings, const int blockSize, const bool crossfade, const DelayLine::Interpolation interpolation )
+{
+    Random random (1);
+    DelayLine delayLine;
+    delayLine.prepareToPlay( blockSize, settings.sampleRate );
+    delayLine.setSize( 1, settings.sampleRate );
+    delayLine.setInterpolation( interpolation );
+    
+    AudioBuffer<float> input (1, blockSize);
+    AudioBuffer<float> output (1, blockSize);
+    int numTaps = crossfade ? 2 : 1;
+    float delaysInFractionalSamples[2];
+    float gains[2] = { 0.7f, 0.3f };
+    float allpassStates[2] = { 0.f, 0.f };
+    
+    double elapsed = timeBlocks( settings,
+        [&]()
+        {
+            fillWithNoise( input, random );
+            delayLine.copyFrom( 0, input, 0, 0, blockSize );
+            delayLine.incrementWritePosition( blockSize );
+            for( int t = 0; t < numTaps; t++ ){ delaysInFractionalSamples[t] = blockSize + random.nextFloat() * ( settings.sampleRate - 2*blockSize ); }
+        },
+        [&]()
+        {
+            delayLine.fillBufferWithDelayedTaps( output.getWritePointer(0), 0, delaysInFractionalSamples, gains, numTaps, blockSize, allpassStates );
+        });
+    printResult( settings, "DelayLine::fillBufferWithDelayedTaps (" + DelayLine::getInterpolationName( interpolation ) + ")", blockSize, 1, 0, crossfade, elapsed );
+}
+
+// delay of one source image ramped along the block (SourceImagesHandler::enableDelayRamping, during crossfade)
+void benchRampedDelay( const BenchSettings & settings, const int blockSize, const DelayLine::Interpolation interpolation )
+{
+    Random random (1);
+    DelayLine delayLine;
+    delayLine.prepareToPlay( blockSize, settings.sampleRate );
+    delayLine.setSize( 1, settings.sampleRate );
+    delayLine.setInterpolation( interpolation );
+    
+    AudioBuffer<float> input (1, blockSize);
+    AudioBuffer<float> output (1, blockSize);
+    float delayStart = blockSize, delayEnd = blockSize;
+    float allpassState = 0.f;
+    
+    double elapsed = timeBlocks( settings,
+        [&]()
+        {
+            fillWithNoise( input, random );
+            delayLine.copyFrom( 0, input, 0, 0, blockSize );
+            delayLine.incrementWritePosition( blockSize );
+            delayStart = delayEnd;
+            delayEnd = jlimit( (float)blockSize, (float)( settings.sampleRate - 2*blockSize ), delayStart + ( random.nextFloat() - 0.5f ) * 0.2f * blockSize );
+        },
+        [&]()
+        {
+            delayLine.fillBufferWithRampedDelay( output.getWritePointer(0), 0, delayStart, delayEnd, 0.7f, blockSize, &allpassState );
+        });
+    printResult( settings, "DelayLine::fillBufferWithRampedDelay (" + DelayLine::getInterpolationName( interpolation ) + ")", blockSize, 1, 0, true, elapsed );
+}
+
+// band decomposition of one source image
+void benchFilterBank( const BenchSettings & settings, const int blockSize, const int numFreqBands )
+{
+    Random random (2);
+    FilterBank filterBank;
+    FilterBank::FilterState filterState;
+    filterBank.prepareToPlay( blockSize, settings.sampleRate );
+    filterBank.setNumBands( numFreqBands );
+    
+    AudioBuffer<float> input (1, blockSize);
+    AudioBuffer<float> bandBuffer (numFreqBands, blockSize);
+    
+    double elapsed = timeBlocks( settings,
+        [&](){ fillWithNoise( input, random ); },
+        [&](){ filterBank.decomposeBuffer( input, bandBuffer, filterState ); });
+    printResult( settings, "FilterBank::decomposeBuffer", blockSize, 1, numFreqBands, false, elapsed );
+    
+    // one source image per SIMD lane
+    std::array<FilterBank::FilterState, FilterBank::numLanes> filterStates;
+    AudioBuffer<float> inputs (FilterBank::numLanes, blockSize);
+    std::array<AudioBuffer<float>, FilterBank::numLanes> bandBuffers;
+    const float* sources[FilterBank::numLanes];
+    AudioBuffer<float>* destinations[FilterBank::numLanes];
+    FilterBank::FilterState* states[FilterBank::numLanes];
+    for( int lane = 0; lane < FilterBank::numLanes; lane++ )
+    {
+        bandBuffers[lane].setSize( numFreqBands, blockSize );
+        sources[lane] = inputs.getReadPointer( lane );
+        destinations[lane] = &bandBuffers[lane];
+        states[lane] = &filterStates[lane];
+    }
+    
+    elapsed = timeBlocks( settings,
+        [&](){ fillWithNoise( inputs, random ); },
+        [&](){ filterBank.decomposeBuffers( sources, destinations, states ); });
+    printResult( settings, "FilterBank::decomposeBuffers", blockSize, FilterBank::numLanes, numFreqBands, false, elapsed );
+}
+
+// filter bank design: bands of an impulse (one per lane) are decomposed, each lowpass filter response is measured
+// from its output (band i) and input (remaining spectrum, input minus bands 0 to i-1), and checked at its cut-off
+// frequency (-3.01 dB, see FilterBank::getCrossoverFrequency) and one octave above / below it (Butterworth lowpass,
+// bilinear transform). Returns false if a value deviates by more than 0.05 dB.
+bool checkFilterBank( const BenchSettings & settings, const int numFreqBands )
+{
+    const int length = 8192;
+    FilterBank filterBank;
+    filterBank.prepareToPlay( length, settings.sampleRate );
+    filterBank.setNumBands( numFreqBands );
+    
+    std::array<FilterBank::FilterState, FilterBank::numLanes> filterStates;
+    AudioBuffer<float> inputs (FilterBank::numLanes, length);
+    std::array<AudioBuffer<float>, FilterBank::numLanes> bandBuffers;
+    const float* sources[FilterBank::numLanes];
+    AudioBuffer<float>* destinations[FilterBank::numLanes];
+    FilterBank::FilterState* states[FilterBank::numLanes];
+    inputs.clear();
+    for( int lane = 0; lane < FilterBank::numLanes; lane++ )
+    {
+        inputs.setSample( lane, 0, 1.f );
+        bandBuffers[lane].setSize( numFreqBands, length );
+        sources[lane] = inputs.getReadPointer( lane );
+        destinations[lane] = &bandBuffers[lane];
+        states[lane] = &filterStates[lane];
+    }
+    filterBank.decomposeBuffers( sources, destinations, states );
+    
+    // discrete time Fourier transform of a response at a given frequency
+    auto getSpectrum = [&]( const std::vector<double> & response, const double freq )
+    {
+        std::complex<double> sum = 0.0;
+        for( int n = 0; n < length; n++ ){ sum += response[n] * std::polar( 1.0, -2.0 * M_PI * freq * n / settings.sampleRate ); }
+        return sum;
+    };
+    
+    double maxDeviation = 0.0; // in dB
+    for( int lane = 0; lane < FilterBank::numLanes; lane++ )
+    {
+        std::vector<double> remains ( length, 0.0 );
+        remains[0] = 1.0;
+        for( int i = 0; i < numFreqBands - 1; i++ )
+        {
+            std::vector<double> band ( bandBuffers[lane].getReadPointer(i), bandBuffers[lane].getReadPointer(i) + length );
+            double fc = FilterBank::getCrossoverFrequency( numFreqBands, i );
+            double wc = std::tan( M_PI * fc / settings.sampleRate );
+            for( double freq : { fc / 2, fc, fc * 2 } )
+            {
+                if( freq >= settings.sampleRate / 2 ){ continue; }
+                double ratio = std::pow( std::tan( M_PI * freq / settings.sampleRate ) / wc, 4.0 );
+                double expected = -10.0 * log10( 1.0 + ratio );
+                double measured = 20.0 * log10( std::abs( getSpectrum( band, freq ) / getSpectrum( remains, freq ) ) );
+                maxDeviation = fmax( maxDeviation, fabs( measured - expected ) );
+            }
+            for( int n = 0; n < length; n++ ){ remains[n] -= band[n]; }
+        }
+    }
+    
+    bool isDesigned = maxDeviation <= 0.05;
+    std::cout << "FilterBank crossovers (" << numFreqBands << " bands): max deviation " << maxDeviation << " dB, " << ( isDesigned ? "ok" : "FAILED" ) << std::endl;
+    return isDesigned;
+}
+
+// minimum phase FIR coloration of one source image (replaces band decomposition and recomposition in FIR coloration mode)
+void benchColorationFIR( const BenchSettings & settings, const int blockSize )
+{
+    Random random (8);
+    ColorationFIR colorationFIR;
+    colorationFIR.prepareToPlay( blockSize, settings.sampleRate );
+    
+    float bandGains[NUM_OCTAVE_BANDS];
+    for( int k = 0; k < NUM_OCTAVE_BANDS; k++ ){ bandGains[k] = 1.f - 0.5f * random.nextFloat(); }
+    ComplexVector<float> firSpectrum ( ColorationFIR::numBins );
+    colorationFIR.design( bandGains, NUM_OCTAVE_BANDS, firSpectrum.data() );
+    std::vector<float> history ( ColorationFIR::firLength, 0.f );
+    AudioBuffer<float> buffer (1, blockSize);
+    
+    double elapsed = timeBlocks( settings,
+        [&](){ fillWithNoise( buffer, random ); },
+        [&](){ colorationFIR.process( buffer.getWritePointer(0), blockSize, history.data(), firSpectrum.data() ); });
+    printResult( settings, "ColorationFIR::process (" + String(ColorationFIR::firLength) + " taps)", blockSize, 1, NUM_OCTAVE_BANDS, false, elapsed );
+}
+
+// FIR coloration design: magnitude of the FIR impulse response checked at octave band centers, energy of its
+// first firLength/8 taps checked for minimum phase. Returns false if a band deviates from its gain by more than
+// 1 dB (FIR resolution is sampleRate / firLength) or if less than 90% of the energy comes first.
+bool checkColorationFIR( const BenchSettings & settings, const int numFreqBands )
+{
+    const int length = 2 * ColorationFIR::firLength;
+    ColorationFIR colorationFIR;
+    colorationFIR.prepareToPlay( length, settings.sampleRate );
+    
+    const float bandGains10[NUM_OCTAVE_BANDS] = { 0.9f, 0.8f, 0.7f, 0.5f, 0.6f, 0.4f, 0.3f, 0.35f, 0.2f, 0.1f };
+    const float bandGains3[3] = { 0.9f, 0.5f, 0.2f };
+    const float* bandGains = ( numFreqBands == 3 ) ? bandGains3 : bandGains10;
+    ComplexVector<float> firSpectrum ( ColorationFIR::numBins );
+    colorationFIR.design( bandGains, numFreqBands, firSpectrum.data() );
+    
+    std::vector<float> response ( length, 0.f );
+    std::vector<float> history ( ColorationFIR::firLength, 0.f );
+    response[0] = 1.f;
+    colorationFIR.process( response.data(), length, history.data(), firSpectrum.data() );
+    
+    double maxDeviation = 0.0; // in dB
+    for( int k = 0; k < NUM_OCTAVE_BANDS; k++ )
+    {
+        double freq = 31.5 * std::pow( 2.0, k );
+        if( freq >= settings.sampleRate / 2 ){ break; }
+        std::complex<double> sum = 0.0;
+        for( int n = 0; n < length; n++ ){ sum += (double)response[n] * std::polar( 1.0, -2.0 * M_PI * freq * n / settings.sampleRate ); }
+        float bandGain = ( numFreqBands == 3 ) ? bandGains3[ ( k < 5 ) ? 0 : ( ( k < 9 ) ? 1 : 2 ) ] : bandGains10[k];
+        maxDeviation = fmax( maxDeviation, fabs( 20.0 * log10( std::abs( sum ) / bandGain ) ) );
+    }
+    
+    double energy = 0.0;
+    double firstEnergy = 0.0;
+    for( int n = 0; n < length; n++ )
+    {
+        energy += response[n] * response[n];
+        if( n < ColorationFIR::firLength / 8 ){ firstEnergy += response[n] * response[n]; }
+    }
+    
+    bool isValid = maxDeviation <= 1.0 && firstEnergy >= 0.9 * energy;
+    std::cout << "ColorationFIR magnitude (" << numFreqBands << " bands): max deviation " << maxDeviation << " dB, energy in first taps " << 100.0 * firstEnergy / energy << "%, " << ( isValid ? "ok" : "FAILED" ) << std::endl;
+    return isValid;
+}
+
+// FDN reverb tail (once per block, independent of the number of source images)
+void benchReverbTail( const BenchSettings & settings, const int blockSize )
+{
+    Random random (3);
+    ReverbTail reverbTail;
+    reverbTail.prepareToPlay( blockSize, settings.sampleRate );
+    reverbTail.setDelayInterpolation( settings.delayInterpolation );
+    reverbTail.updateInternals( std::vector<float>( NUM_OCTAVE_BANDS, 1.5f ) );
+    
+    AudioBuffer<float> busInput (ReverbTail::numOctaveBands, blockSize);
+    AudioBuffer<float> tailBuffer (reverbTail.fdnOrder, blockSize);
+    
+    double elapsed = timeBlocks( settings,
+        [&]()
+        {
+            fillWithNoise( busInput, random );
+            for( int busId = 0; busId < reverbTail.fdnOrder; busId++ ){ reverbTail.addToBus( busId, busInput ); }
+        },
+        [&](){ reverbTail.extractBusToBuffer( tailBuffer ); });
+    printResult( settings, "ReverbTail::extractBusToBuffer", blockSize, 0, ReverbTail::numOctaveBands, false, elapsed );
+}
+
+// direct path binaural encoding (crossfade on: new position set before each block)
+void benchBinauralEncoder( const BenchSettings & settings, const int blockSize, BinauralEncoder & binauralEncoder, const bool crossfade )
+{
+    Random random (4);
+    binauralEncoder.prepareToPlay( blockSize, settings.sampleRate );
+    binauralEncoder.setPosition( 0.0, 0.0 );
+    
+    AudioBuffer<float> input (1, blockSize);
+    AudioBuffer<float> output (2, blockSize);
+    
+    // run past initial crossfade
+    for( int b = 0; b < 20; b++ ){ binauralEncoder.encodeBuffer( input, output ); }
+    
+    double elapsed = timeBlocks( settings,
+        [&]()
+        {
+            fillWithNoise( input, random );
+            if( crossfade ){ binauralEncoder.setPosition( M_PI * ( 2.0 * random.nextDouble() - 1.0 ), 0.5 * M_PI * ( 2.0 * random.nextDouble() - 1.0 ) ); }
+        },
+        [&](){ binauralEncoder.encodeBuffer( input, output ); });
+    printResult( settings, "BinauralEncoder::encodeBuffer", blockSize, 1, 0, crossfade, elapsed );
+}
+
+// one FIR of irLength taps (2*N_AMBI_CH of AMBI2BIN_IR_LENGTH taps run per block)
+void benchFIRFilter( const BenchSettings & settings, const int blockSize, const int irLength )
+{
+    Random random (5);
+    std::vector<float> ir (irLength);
+    for( int i = 0; i < ir.size(); i++ ){ ir[i] = ( 2.f * random.nextFloat() - 1.f ) / irLength; }
+    
+    FIRFilter firFilter;
+    firFilter.init( blockSize, irLength );
+    firFilter.setImpulseResponse( ir.data() );
+    
+    AudioBuffer<float> buffer (1, blockSize);
+    
+    double elapsed = timeBlocks( settings,
+        [&](){ fillWithNoise( buffer, random ); },
+        [&](){ firFilter.process( buffer.getWritePointer(0) ); });
+    printResult( settings, "FIRFilter::process (" + String(irLength) + " taps)", blockSize, 0, 0, false, elapsed );
+}
+
+// Ambisonic to binaural decoding (N_AMBI_CH channels to 2 ears, shared forward transforms),
+// symmetric: right filters mirrored from left ones (sign flipped for ACN channels 1, 4, 5)
+void benchAmbi2BinDecoder( const BenchSettings & settings, const int blockSize, const bool symmetric )
+{
+    Random random (8);
+    std::vector<float> ir (AMBI2BIN_IR_LENGTH);
+    
+    Ambi2BinDecoder ambi2binDecoder;
+    ambi2binDecoder.init( blockSize, AMBI2BIN_IR_LENGTH );
+    for( int k = 0; k < N_AMBI_CH; k++ )
+    {
+        for( int i = 0; i < ir.size(); i++ ){ ir[i] = ( 2.f * random.nextFloat() - 1.f ) / AMBI2BIN_IR_LENGTH; }
+        ambi2binDecoder.setImpulseResponse( k, 0, ir.data() );
+        
+        if( symmetric && ( k == 1 || k == 4 || k == 5 ) ){ for( int i = 0; i < ir.size(); i++ ){ ir[i] = -ir[i]; } }
+        else if( !symmetric ){ for( int i = 0; i < ir.size(); i++ ){ ir[i] = ( 2.f * random.nextFloat() - 1.f ) / AMBI2BIN_IR_LENGTH; } }
+        ambi2binDecoder.setImpulseResponse( k, 1, ir.data() );
+    }
+    
+    AudioBuffer<float> ambisonicBuffer (2 + N_AMBI_CH, blockSize);
+    AudioBuffer<float> output (2, blockSize);
+    
+    double elapsed = timeBlocks( settings,
+        [&](){ fillWithNoise( ambisonicBuffer, random ); output.clear(); },
+        [&](){ ambi2binDecoder.processAndAddTo( ambisonicBuffer, 2, output ); });
+    printResult( settings, symmetric ? "Ambi2BinDecoder (symmetric)" : "Ambi2BinDecoder::processAndAddTo", blockSize, 0, 0, false, elapsed );
+}
+
+// measured Ambisonic room response convolution (in place of FDN reverb tail), long partitions on background threads
+void benchPartitionedConvolver( const BenchSettings & settings, const int blockSize, const int irLength )
+{
+    Random random (7);
+    std::vector<float> ir (irLength);
+    for( int i = 0; i < ir.size(); i++ ){ ir[i] = ( 2.f * random.nextFloat() - 1.f ) / irLength; }
+    
+    PartitionedConvolver convolver;
+    convolver.init( blockSize, irLength, N_AMBI_CH );
+    for( int k = 0; k < N_AMBI_CH; k++ ){ convolver.setImpulseResponse( k, ir.data() ); }
+    
+    AudioBuffer<float> input (1, blockSize);
+    AudioBuffer<float> output (N_AMBI_CH, blockSize);
+    
+    double elapsed = timeBlocks( settings,
+        [&](){ fillWithNoise( input, random ); },
+        [&](){ convolver.process( input.getReadPointer(0), output.getArrayOfWritePointers() ); });
+    printResult( settings, "PartitionedConvolver::process (" + String(irLength) + " taps)", blockSize, 0, 0, false, elapsed );
+}
+
+// fill source images handler state with a synthetic scene (crossfade: all source images ramping from random start parameters,
+// firColoration: band gains applied by minimum phase FIRs designed for sampleRate)
+void setSyntheticScene( SourceImagesHandler & sourceImagesHandler, const int numSourceImages, const int numFreqBands, const float maxDelay, const bool crossfade, const bool firColoration, const double sampleRate )
+{
+    Random random (6);
+    AmbixEncoder ambixEncoder;
+    ColorationFIR colorationFIR;
+    colorationFIR.prepareToPlay( 0, sampleRate );
+    
+    SceneState* state = sourceImagesHandler.current;
+    state->resize( numSourceImages, numFreqBands, firColoration );
+    state->numSlots = numSourceImages;
+    state->directPathId = -1;
+    
+    // source image j in slot j
+    SourceImageSlots & slots = *sourceImagesHandler.slots;
+    slots.resize( numSourceImages );
+    
+    for( int j = 0; j < numSourceImages; j++ )
+    {
+        state->ids[j] = j;
+        state->slots[j] = j;
+        state->delays[j] = 0.001f + random.nextFloat() * ( maxDelay - 0.001f );
+        state->pathLengths[j] = state->delays[j] * SOUND_SPEED;
+        
+        slots.ids[j] = j;
+        slots.delaysStart[j] = crossfade ? 0.001f + random.nextFloat() * ( maxDelay - 0.001f ) : state->delays[j];
+        slots.delaysEnd[j] = state->delays[j];
+        slots.gainsStart[j] = fmin( 1.f, 1.f / ( slots.delaysStart[j] * SOUND_SPEED ) );
+        slots.gainsEnd[j] = fmin( 1.f, 1.f / state->pathLengths[j] );
+        slots.levelsStart[j] = 1.f;
+        slots.levelsTarget[j] = 1.f;
+        
+        for( int k = 0; k < numFreqBands; k++ )
+        {
+            state->bandGains[j*numFreqBands + k] = 1.f - 0.5f * random.nextFloat(); // absorption only
+            slots.bandGainsStart[j*NUM_OCTAVE_BANDS + k] = 1.f - 0.5f * random.nextFloat();
+            slots.bandGainsTarget[j*NUM_OCTAVE_BANDS + k] = state->bandGains[j*numFreqBands + k];
+        }
+        if( firColoration )
+        {
+            colorationFIR.design( &state->bandGains[j*numFreqBands], numFreqBands, &state->firSpectra[j*ColorationFIR::numBins] );
+            colorationFIR.design( &slots.bandGainsStart[j*NUM_OCTAVE_BANDS], numFreqBands, &slots.firSpectraStart[j*ColorationFIR::numBins] );
+            std::copy_n( state->firSpectra.begin() + j*ColorationFIR::numBins, ColorationFIR::numBins, slots.firSpectraTarget.begin() + j*ColorationFIR::numBins );
+        }
+        
+        for( int s = 0; s < 2; s++ )
+        {
+            Array<float> ambisonicGains = ambixEncoder.calcParams( M_PI * ( 2.0 * random.nextDouble() - 1.0 ), 0.5 * M_PI * ( 2.0 * random.nextDouble() - 1.0 ) );
+            float* gains = ( s == 0 ) ? &slots.ambisonicGainsTarget[j*N_AMBI_CH] : &slots.ambisonicGainsStart[j*N_AMBI_CH];
+            for( int k = 0; k < N_AMBI_CH; k++ ){ gains[k] = ambisonicGains[k]; }
+        }
+        std::copy_n( slots.ambisonicGainsTarget.begin() + j*N_AMBI_CH, N_AMBI_CH, state->ambisonicGains.begin() + j*N_AMBI_CH );
+        
+        slots.rampPositions[j] = crossfade ? 0.f : 1.f;
+        slots.delayRampPositions[j] = crossfade ? 0.f : 1.f;
+    }
+    
+    sourceImagesHandler.setFilterBankSize( numFreqBands );
+    sourceImagesHandler.numSourceImages = numSourceImages;
+    
+    // crossfade on: tiny crossfade step keeps source images ramping for the whole measure
+    sourceImagesHandler.crossfadeStep = 1e-6f;
+}
+
+// whole source images processing (delay taps, absorption, reverb bus, Ambisonic encoding, reverb tail)
+void benchSourceImagesHandler( const BenchSettings & settings, const int blockSize, SourceImagesHandler & sourceImagesHandler )
+{
+    Random random (7);
+    const float maxDelay = 0.3f; // in sec
+    
+    sourceImagesHandler.prepareToPlay( blockSize, settings.sampleRate );
+    sourceImagesHandler.enableReverbTail = true;
+    sourceImagesHandler.enableDirectToBinaural = false;
+    sourceImagesHandler.reverbTail.updateInternals( std::vector<float>( NUM_OCTAVE_BANDS, 1.5f ) );
+    sourceImagesHandler.reverbTail.setDelayInterpolation( settings.delayInterpolation );
+    
+    DelayLine delayLine;
+    delayLine.prepareToPlay( blockSize, settings.sampleRate );
+    delayLine.setSize( 1, 1.5 * maxDelay * settings.sampleRate );
+    delayLine.setInterpolation( settings.delayInterpolation );
+    
+    AudioBuffer<float> input (1, blockSize);
+    AudioBuffer<float> ambisonicBuffer (2 + N_AMBI_CH, blockSize);
+    
+    for( int firColoration = 0; firColoration < 2; firColoration++ )
+    {
+        for( int numFreqBands : numFreqBandsValues )
+        {
+            for( int numSourceImages : numSourceImagesValues )
+            {
+                for( int crossfade = 0; crossfade < 2; crossfade++ )
+                {
+                    setSyntheticScene( sourceImagesHandler, numSourceImages, numFreqBands, maxDelay, crossfade == 1, firColoration == 1, settings.sampleRate );
+                    
+                    double elapsed = timeBlocks( settings,
+                        [&]()
+                        {
+                            fillWithNoise( input, random );
+                            delayLine.copyFrom( 0, input, 0, 0, blockSize );
+                        },
+                        [&]()
+                        {
+                            sourceImagesHandler.getNextAudioBlock( &delayLine, ambisonicBuffer );
+                            delayLine.incrementWritePosition( blockSize );
+                        });
+                    String stageName = ( firColoration == 1 ) ? "SourceImagesHandler::getNextAudioBlock (FIR coloration)" : "SourceImagesHandler::getNextAudioBlock";
+                    printResult( settings, stageName, blockSize, numSourceImages, numFreqBands, crossfade == 1, elapsed );
+                }
+            }
+        }
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    // required by file loaders (HRIR, directivity)
+    ScopedJuceInitialiser_GUI juceInitialiser;
+    
+    //==========================================================================
+    // PARSE ARGUMENTS
+    
+    BenchSettings settings = { 48000.0, 100, 10, false, 1, DelayLine::Interpolation::Linear };
+    String stage = "all";
+    
+    for( int i = 1; i < argc; i++ )
+    {
+        String arg (argv[i]);
+        bool hasValue = ( i + 1 < argc );
+        
+        if( arg == "-r" && hasValue ){ settings.sampleRate = String(argv[++i]).getDoubleValue(); }
+        else if( arg == "-n" && hasValue ){ settings.numBlocks = String(argv[++i]).getIntValue(); }
+        else if( arg == "-j" && hasValue ){ settings.numWorkerThreads = String(argv[++i]).getIntValue(); }
+        else if( arg == "-s" && hasValue ){ stage = argv[++i]; }
+        else if( arg == "--csv" ){ settings.csvOutput = true; }
+        else if( arg == "--ooura-fft" ){ FFTBackend::defaultType = FFTBackend::Type::Ooura; }
+        else if( arg == "--interpolation" && hasValue && DelayLine::getInterpolationFromName( argv[i+1], settings.delayInterpolation ) ){ i++; }
+        else{ printUsage(); return 1; }
+    }
+    
+    if( settings.sampleRate <= 0 || settings.numBlocks <= 0 || settings.numWorkerThreads <= 0 )
+    {
+        printUsage();
+        return 1;
+    }
+    
+    //==========================================================================
+    // RUN
+    
+    // heavy objects (load data files at construction) shared across measures
+    ScopedPointer<BinauralEncoder> binauralEncoder = new BinauralEncoder();
+    ScopedPointer<SourceImagesHandler> sourceImagesHandler = new SourceImagesHandler();
+    sourceImagesHandler->directivityHandler.loadFile( "omni.sofa" );
+    sourceImagesHandler->numWorkerThreads = settings.numWorkerThreads;
+    
+    // design checks, exit code tells if they passed when run alone
+    if( stage == "check" )
+    {
+        bool passed = true;
+        for( int numFreqBands : numFreqBandsValues ){ passed = checkFilterBank( settings, numFreqBands ) && passed; }
+        for( int numFreqBands : numFreqBandsValues ){ passed = checkColorationFIR( settings, numFreqBands ) && passed; }
+        return passed ? 0 : 1;
+    }
+    
+    printHeader( settings );
+    
+    for( int blockSize : blockSizes )
+    {
+        if( stage == "all" || stage == "delay" )
+        {
+            for( auto interpolation : { DelayLine::Interpolation::Linear, DelayLine::Interpolation::Lagrange3, DelayLine::Interpolation::Thiran, DelayLine::Interpolation::WindowedSinc } )
+            {
+                benchDelayLine( settings, blockSize, false, interpolation );
+                benchDelayLine( settings, blockSize, true, interpolation );
+                benchRampedDelay( settings, blockSize, interpolation );
+            }
+        }
+        if( stage == "all" || stage == "filterbank" )
+        {
+            for( int numFreqBands : numFreqBandsValues ){ benchFilterBank( settings, blockSize, numFreqBands ); }
+            benchColorationFIR( settings, blockSize );
+        }
+        if( stage == "all" || stage == "reverb" ){ benchReverbTail( settings, blockSize ); }
+        if( stage == "all" || stage == "binaural" )
+        {
+            benchBinauralEncoder( settings, blockSize, *binauralEncoder, false );
+            benchBinauralEncoder( settings, blockSize, *binauralEncoder, true );
+        }
+        if( stage == "all" || stage == "fir" )
+        {
+            benchFIRFilter( settings, blockSize, AMBI2BIN_IR_LENGTH );
+            benchAmbi2BinDecoder( settings, blockSize, false );
+            benchAmbi2BinDecoder( settings, blockSize, true );
+            benchFIRFilter( settings, blockSize, (int)( 2.0 * settings.sampleRate ) ); // 2 sec room response
+            benchPartitionedConvolver( settings, blockSize, (int)( 2.0 * settings.sampleRate ) );
+        }
+        if( stage == "all" || stage == "sourceimages" ){ benchSourceImagesHandler( settings, blockSize, *sourceImagesHandler ); }
+    }
+    
+    return 0;
+}
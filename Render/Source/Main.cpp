@@ -0,0 +1,309 @@
+/*
+  ==============================================================================
+
+    Offline (headless) renderer of the EVERTims auralization engine: feeds an
+    audio file and a saved OSC scene through the AuralizationEngine faster than
+    real time, writes binaural and Ambisonic outputs to disk.
+
+  ==============================================================================
+*/
+
+#include "../../Source/AuralizationEngine.h"
+
+#include <iostream>
+#include <vector>
+
+// scene snapshot: OSC state (getMapContentForLog format) applied at a given time
+struct SceneSnapshot
+{
+    double time; // in sec
+    String content;
+};
+
+//==============================================================================
+// print command line usage
+void printUsage()
+{
+    std::cout << "usage: EvertSE_Render -i input.wav -s scene.txt -o outputPrefix [options]" << std::endl;
+    std::cout << "  -i  input audio file (downmixed to mono)" << std::endl;
+    std::cout << "  -s  scene file, OSC state as saved by EvertSE (\"Save OSC state to Desktop\")," << std::endl;
+    std::cout << "      split in snapshots by \"time: <sec>\" lines for time varying scenes" << std::endl;
+    std::cout << "  -o  output prefix, writes <prefix>_binaural.wav and <prefix>_ambi_<order>_order.wav" << std::endl;
+    std::cout << "  -b  block size in samples (default 512)" << std::endl;
+    std::cout << "  -f  number of absorption frequency bands, 3 or 10 (default 3)" << std::endl;
+    std::cout << "  -d  source directivity, omni or directional (default omni)" << std::endl;
+    std::cout << "  -j  number of threads processing source images (default 1)" << std::endl;
+    std::cout << "  -r  measured Ambisonic room impulse response (ambiX), convolved in place of the FDN reverb tail" << std::endl;
+    std::cout << "  -t  tail duration in sec rendered after input end (default: max(delay) + max(rt60))" << std::endl;
+    std::cout << "  --interpolation  fractional delay interpolation: linear, lagrange3, thiran or sinc (default linear)" << std::endl;
+    std::cout << "  --delay-ramping  ramp source image delays on scene updates (Doppler) instead of crossfading two delay taps" << std::endl;
+    std::cout << "  --fir-coloration  apply absorption / directivity with one minimum phase FIR per source image instead of the filter bank" << std::endl;
+    std::cout << "  --lod-orders  max reflection order rendered in full detail, and Ambisonic encoded (higher orders only feed the reverb tail), e.g. 3 6" << std::endl;
+    std::cout << "  --max-images  max number of source images rendered, loudest first (predicted energy), the others are faded out" << std::endl;
+    std::cout << "  --cpu-budget  target source images processing time, as a fraction of block duration (lowers --lod-orders, then" << std::endl;
+    std::cout << "                culls the quietest source images when over budget)" << std::endl;
+    std::cout << "  --clustering  merge source images of reflection order >= minOrder within angle (degrees) / delay (ms) grid cells, e.g. 3 10 1" << std::endl;
+    std::cout << "  --no-reverb-tail, --direct-to-binaural" << std::endl;
+}
+
+// split scene file content into time stamped snapshots
+std::vector<SceneSnapshot> loadScene( const File & sceneFile )
+{
+    std::vector<SceneSnapshot> snapshots;
+    SceneSnapshot snapshot = { 0.0, String() };
+    
+    StringArray lines;
+    sceneFile.readLines( lines );
+    for( int l = 0; l < lines.size(); l++ )
+    {
+        String line = lines[l].trim();
+        
+        // new snapshot
+        if( line.startsWith("time:") )
+        {
+            if( snapshot.content.isNotEmpty() ){ snapshots.push_back( snapshot ); }
+            snapshot.time = line.fromFirstOccurrenceOf(":", false, false).getDoubleValue();
+            snapshot.content = String();
+        }
+        else if( line.isNotEmpty() ){ snapshot.content += line + String("\n"); }
+    }
+    if( snapshot.content.isNotEmpty() ){ snapshots.push_back( snapshot ); }
+    
+    return snapshots;
+}
+
+// create wav writer (32 bit float, output of the engine is not clipped)
+AudioFormatWriter* createWavWriter( const File & file, const double sampleRate, const unsigned int numChannels )
+{
+    file.deleteFile();
+    ScopedPointer<FileOutputStream> fileStream (file.createOutputStream());
+    if( fileStream == nullptr ){ return nullptr; }
+    
+    WavAudioFormat wavFormat;
+    AudioFormatWriter* writer = wavFormat.createWriterFor (fileStream, sampleRate, numChannels, 32, StringPairArray(), 0);
+    if( writer != nullptr )
+    {
+        fileStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
+    }
+    return writer;
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    // required by OSCHandler (component) and file loaders
+    ScopedJuceInitialiser_GUI juceInitialiser;
+    
+    //==========================================================================
+    // PARSE ARGUMENTS
+    
+    String inputPath, scenePath, outputPrefix, rirPath;
+    String directivity = "omni";
+    int samplesPerBlock = 512;
+    int numFreqBands = 3;
+    int numWorkerThreads = 1;
+    double tailDuration = -1.0;
+    bool enableReverbTail = true;
+    bool enableDirectToBinaural = false;
+    bool enableDelayRamping = false;
+    bool enableFirColoration = false;
+    SourceImagesHandler::LevelOfDetailPolicy levelOfDetailPolicy;
+    float cpuBudget = 0.f;
+    bool enableClustering = false;
+    int minClusteredOrder = 3;
+    float clusterAngle = 10.f;
+    float clusterDelay = 0.001f;
+    DelayLine::Interpolation delayInterpolation = DelayLine::Interpolation::Linear;
+    
+    for( int i = 1; i < argc; i++ )
+    {
+        String arg (argv[i]);
+        bool hasValue = ( i + 1 < argc );
+        
+        if( arg == "-i" && hasValue ){ inputPath = argv[++i]; }
+        else if( arg == "-s" && hasValue ){ scenePath = argv[++i]; }
+        else if( arg == "-o" && hasValue ){ outputPrefix = argv[++i]; }
+        else if( arg == "-b" && hasValue ){ samplesPerBlock = String(argv[++i]).getIntValue(); }
+        else if( arg == "-f" && hasValue ){ numFreqBands = String(argv[++i]).getIntValue(); }
+        else if( arg == "-d" && hasValue ){ directivity = argv[++i]; }
+        else if( arg == "-j" && hasValue ){ numWorkerThreads = String(argv[++i]).getIntValue(); }
+        else if( arg == "-r" && hasValue ){ rirPath = argv[++i]; }
+        else if( arg == "-t" && hasValue ){ tailDuration = String(argv[++i]).getDoubleValue(); }
+        else if( arg == "--no-reverb-tail" ){ enableReverbTail = false; }
+        else if( arg == "--direct-to-binaural" ){ enableDirectToBinaural = true; }
+        else if( arg == "--delay-ramping" ){ enableDelayRamping = true; }
+        else if( arg == "--fir-coloration" ){ enableFirColoration = true; }
+        else if( arg == "--lod-orders" && i + 2 < argc )
+        {
+            levelOfDetailPolicy.maxFullDetailOrder = String(argv[++i]).getIntValue();
+            levelOfDetailPolicy.maxEncodedOrder = String(argv[++i]).getIntValue();
+        }
+        else if( arg == "--max-images" && hasValue ){ levelOfDetailPolicy.maxRenderedImages = String(argv[++i]).getIntValue(); }
+        else if( arg == "--cpu-budget" && hasValue ){ cpuBudget = String(argv[++i]).getFloatValue(); }
+        else if( arg == "--clustering" && i + 3 < argc )
+        {
+            enableClustering = true;
+            minClusteredOrder = String(argv[++i]).getIntValue();
+            clusterAngle = String(argv[++i]).getFloatValue();
+            clusterDelay = String(argv[++i]).getFloatValue() / 1000.f;
+        }
+        else if( arg == "--interpolation" && hasValue && DelayLine::getInterpolationFromName( argv[i+1], delayInterpolation ) ){ i++; }
+        else{ printUsage(); return 1; }
+    }
+    
+    if( inputPath.isEmpty() || scenePath.isEmpty() || outputPrefix.isEmpty() || samplesPerBlock <= 0 || numWorkerThreads <= 0 || ( numFreqBands != 3 && numFreqBands != 10 ) )
+    {
+        printUsage();
+        return 1;
+    }
+    
+    //==========================================================================
+    // LOAD INPUTS
+    
+    File inputFile = File::getCurrentWorkingDirectory().getChildFile( inputPath );
+    File sceneFile = File::getCurrentWorkingDirectory().getChildFile( scenePath );
+    File outputFile = File::getCurrentWorkingDirectory().getChildFile( outputPrefix );
+    
+    AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+    ScopedPointer<AudioFormatReader> reader = formatManager.createReaderFor( inputFile );
+    if( reader == nullptr )
+    {
+        std::cerr << "failed to open input file: " << inputPath << std::endl;
+        return 1;
+    }
+    double sampleRate = reader->sampleRate;
+    int64 inputLength = reader->lengthInSamples;
+    
+    std::vector<SceneSnapshot> snapshots = loadScene( sceneFile );
+    if( snapshots.size() == 0 )
+    {
+        std::cerr << "failed to load scene file (or empty scene): " << scenePath << std::endl;
+        return 1;
+    }
+    
+    //==========================================================================
+    // INIT AUDIO PROCESSING CHAIN
+    
+    OSCHandler oscHandler( false );
+    AuralizationEngine auralizationEngine;
+    
+    SourceImagesHandler & sourceImagesHandler = auralizationEngine.sourceImagesHandler;
+    sourceImagesHandler.directivityHandler.loadFile( directivity == "directional" ? "directional.sofa" : "omni.sofa" );
+    sourceImagesHandler.enableReverbTail = enableReverbTail;
+    sourceImagesHandler.enableDirectToBinaural = enableDirectToBinaural;
+    sourceImagesHandler.enableDelayRamping = enableDelayRamping;
+    sourceImagesHandler.enableFirColoration = enableFirColoration;
+    sourceImagesHandler.levelOfDetailPolicy = levelOfDetailPolicy;
+    sourceImagesHandler.cpuBudget.targetLoad = cpuBudget;
+    sourceImagesHandler.enableClustering = enableClustering;
+    sourceImagesHandler.minClusteredOrder = minClusteredOrder;
+    sourceImagesHandler.clusterAngle = clusterAngle;
+    sourceImagesHandler.clusterDelay = clusterDelay;
+    sourceImagesHandler.numWorkerThreads = numWorkerThreads;
+    if( rirPath.isNotEmpty() && !sourceImagesHandler.convolutionReverbTail.loadFile( File::getCurrentWorkingDirectory().getChildFile( rirPath ) ) )
+    {
+        std::cerr << "failed to open room impulse response file: " << rirPath << std::endl;
+        return 1;
+    }
+    
+    auralizationEngine.prepareToPlay( samplesPerBlock, sampleRate );
+    auralizationEngine.setNumFreqBands( numFreqBands, oscHandler );
+    auralizationEngine.setDelayInterpolation( delayInterpolation );
+    
+    ScopedPointer<AudioFormatWriter> binauralWriter = createWavWriter( outputFile.getSiblingFile( outputFile.getFileName() + "_binaural.wav" ), sampleRate, 2 );
+    ScopedPointer<AudioFormatWriter> ambisonicWriter = createWavWriter( outputFile.getSiblingFile( outputFile.getFileName() + "_ambi_" + String(AMBI_ORDER) + "_order.wav" ), sampleRate, N_AMBI_CH );
+    if( binauralWriter == nullptr || ambisonicWriter == nullptr )
+    {
+        std::cerr << "failed to create output files: " << outputPrefix << std::endl;
+        return 1;
+    }
+    
+    // io buffer: same layout as audio device buffer (stereo, input on 1st channel)
+    AudioBuffer<float> ioBuffer (2, samplesPerBlock);
+    AudioBuffer<float> readBuffer (2, samplesPerBlock);
+    AudioBuffer<float> ambisonicOutputBuffer (N_AMBI_CH, samplesPerBlock);
+    
+    //==========================================================================
+    // RENDER
+    
+    int64 tailLength = ( tailDuration >= 0 ) ? (int64)( tailDuration * sampleRate ) : 0;
+    int64 sampleIndex = 0;
+    size_t snapshotId = 0;
+    int64 numBlocks = 0;
+    double processingTime = 0.0;
+    
+    while( sampleIndex < inputLength + tailLength || snapshotId < snapshots.size() )
+    {
+        // apply scene snapshots due in this block
+        while( snapshotId < snapshots.size() && snapshots[snapshotId].time * sampleRate < sampleIndex + samplesPerBlock )
+        {
+            oscHandler.clear( true );
+            oscHandler.loadMapContentFromLog( snapshots[snapshotId].content );
+            oscHandler.updateInternals();
+            auralizationEngine.updateFromOscHandler( oscHandler );
+            
+            // default tail: longest source image delay + longest reverberation time (as for IR recording)
+            if( tailDuration < 0 )
+            {
+                float maxDelay = fmax( getMaxValue( oscHandler.getSourceImageDelays() ), getMaxValue( oscHandler.getRT60Values() ) );
+                tailLength = jmax( tailLength, (int64)( maxDelay * sampleRate ) );
+            }
+            snapshotId++;
+        }
+        
+        // read input (stereo downmix to mono, as for audio file player), zero padded after input end
+        ioBuffer.clear();
+        if( sampleIndex < inputLength )
+        {
+            int numSamplesToRead = (int) jmin( (int64) samplesPerBlock, inputLength - sampleIndex );
+            readBuffer.clear();
+            reader->read( &readBuffer, 0, numSamplesToRead, sampleIndex, true, true );
+            ioBuffer.copyFrom(0, 0, readBuffer, 0, 0, numSamplesToRead);
+            if( reader->numChannels > 1 )
+            {
+                ioBuffer.applyGain(0, 0, numSamplesToRead, 0.5f);
+                ioBuffer.addFrom(0, 0, readBuffer, 1, 0, numSamplesToRead, 0.5f);
+            }
+        }
+        
+        // execute main audio processing (same calls as the main application audio callback)
+        int64 startTicks = Time::getHighResolutionTicks();
+        
+        auralizationEngine.applyPendingUpdates();
+        auralizationEngine.processAmbisonicBuffer( &ioBuffer );
+        for( int k = 0; k < N_AMBI_CH; k++ )
+        {
+            ambisonicOutputBuffer.copyFrom(k, 0, auralizationEngine.ambisonicBuffer, k+2, 0, samplesPerBlock);
+        }
+        auralizationEngine.fillNextAudioBlock( &ioBuffer );
+        
+        processingTime += Time::highResolutionTicksToSeconds( Time::getHighResolutionTicks() - startTicks );
+        
+        // if no source image, data in ambisonicBuffer is meaningless: write raw input to W channel rather
+        if( sourceImagesHandler.numSourceImages == 0 )
+        {
+            ambisonicOutputBuffer.clear();
+            ambisonicOutputBuffer.copyFrom(0, 0, auralizationEngine.workingBuffer, 0, 0, samplesPerBlock);
+        }
+        
+        // write to disk
+        binauralWriter->writeFromAudioSampleBuffer( ioBuffer, 0, samplesPerBlock );
+        ambisonicWriter->writeFromAudioSampleBuffer( ambisonicOutputBuffer, 0, samplesPerBlock );
+        
+        sampleIndex += samplesPerBlock;
+        numBlocks++;
+    }
+    
+    //==========================================================================
+    // REPORT THROUGHPUT
+    
+    double renderedDuration = sampleIndex / sampleRate;
+    double blockDuration = samplesPerBlock / sampleRate;
+    std::cout << "rendered " << renderedDuration << " sec (" << numBlocks << " blocks of " << samplesPerBlock << " samples at " << sampleRate << " Hz)" << std::endl;
+    std::cout << "processing time: " << processingTime << " sec, " << ( renderedDuration / fmax( processingTime, 1e-9 ) ) << "x real time" << std::endl;
+    double meanBlockTime = processingTime / jmax( (int64) 1, numBlocks );
+    std::cout << "mean block time: " << 1000.0 * meanBlockTime << " ms (" << 100.0 * meanBlockTime / blockDuration << "% of real-time budget)" << std::endl;
+    
+    return 0;
+}
@@ -0,0 +1,202 @@
+#ifndef AMBI2BINDECODER_H_INCLUDED
+#define AMBI2BINDECODER_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "FIRFilter/FFTBackend.h"
+#include "Utils.h"
+#include <algorithm>
+#include <array>
+
+// Ambisonic to binaural decoding in the frequency domain: the spectrum of each Ambisonic channel
+// is computed once and shared by both ears, ear spectra are summed over channels before the inverse
+// transform (N_AMBI_CH forward and 2 inverse FFTs per block, against 2*N_AMBI_CH of each with one
+// FIRFilter per channel and ear). Filters are uniformly partitioned as in FIRFilter (no added latency).
+//
+// Symmetric mode: with a left / right symmetric head, the right ear filter of each channel is the left
+// one, sign flipped for channels odd in azimuth (ACN channels of degree m < 0). Left filters are then
+// applied to mid (even channels) and side (odd channels) sums, left = mid + side and right = mid - side:
+// half the multiply-accumulates. Used whenever filters are detected as symmetric when set.
+class Ambi2BinDecoder
+{
+
+//==========================================================================
+// ATTRIBUTES
+
+public:
+    
+    bool enableSymmetricDecoding = true; // use symmetric mode when filters allow it
+
+private:
+    
+    FFTBackend fftBackend;
+    
+    int blockSize = 0;
+    int irLength = 0;
+    int nfft = 0;
+    int numBins = 0;
+    int numPartitions = 0;
+    int fdlPos = 0; // index of the most recent input spectra in inputSpectra
+    
+    std::array< std::vector<float>, N_AMBI_CH > inputWindows; // sliding window over the last nfft samples of each channel
+    std::array< std::vector< ComplexVector<float> >, N_AMBI_CH > inputSpectra; // frequency-domain delay line [channel][partition][bin]
+    std::array< std::array< std::vector< ComplexVector<float> >, 2 >, N_AMBI_CH > filterSpectra; // [channel][ear][partition][bin], ifft normalization included
+    std::array< ComplexVector<float>, 2 > earSpectra; // accumulated output spectrum of each ear
+    std::vector<float> timeBuffer; // fft / ifft buffer
+    
+    std::array<bool, N_AMBI_CH> isMirroredChannel; // right filter == +/- left filter
+    bool isSymmetric = false; // all channels mirrored
+
+//==========================================================================
+// METHODS
+
+public:
+
+Ambi2BinDecoder() {}
+
+~Ambi2BinDecoder() {}
+
+// allocate for blocks of samplesPerBlockExpected and decoding filters of filterLength samples (not to be called from audio thread)
+void init( const int samplesPerBlockExpected, const int filterLength )
+{
+    blockSize = samplesPerBlockExpected;
+    irLength = filterLength;
+    
+    // partitions of blockSize samples, overlap-save requires nfft >= 2*blockSize-1
+    nfft = nextPowerOf2( 2 * blockSize - 1 );
+    numBins = nfft / 2 + 1;
+    numPartitions = ( irLength + blockSize - 1 ) / blockSize;
+    fftBackend.init( nfft );
+    
+    for( int k = 0; k < N_AMBI_CH; k++ )
+    {
+        inputWindows[k].assign( nfft, 0.f );
+        inputSpectra[k].assign( numPartitions, ComplexVector<float>( numBins ) );
+        for( int earId = 0; earId < 2; earId++ ){ filterSpectra[k][earId].assign( numPartitions, ComplexVector<float>( numBins ) ); }
+    }
+    for( int earId = 0; earId < 2; earId++ ){ earSpectra[earId].resize( numBins ); }
+    timeBuffer.resize( nfft );
+    fdlPos = 0;
+    
+    isMirroredChannel.fill( false );
+    isSymmetric = false;
+}
+
+// set decoding filter (filterLength samples) of a given Ambisonic channel and ear (0: left, 1: right)
+void setImpulseResponse( const int ambiChannel, const int earId, const float* ir )
+{
+    float scale = 2.f / nfft;
+    for( int p = 0; p < numPartitions; p++ )
+    {
+        int partitionSize = jmin( blockSize, irLength - p * blockSize );
+        std::fill( timeBuffer.begin(), timeBuffer.end(), 0.f );
+        FloatVectorOperations::copyWithMultiply( timeBuffer.data(), ir + p * blockSize, scale, partitionSize );
+        fftBackend.fft( timeBuffer.data(), filterSpectra[ambiChannel][earId][p].data() );
+    }
+    
+    // detect symmetry (relative tolerance on spectra)
+    float maxMagnitude = 0.f;
+    float maxDifference = 0.f;
+    float sign = (float)getMirrorSign( ambiChannel );
+    for( int p = 0; p < numPartitions; p++ )
+    {
+        for( int i = 0; i < numBins; i++ )
+        {
+            maxMagnitude = jmax( maxMagnitude, std::abs( filterSpectra[ambiChannel][0][p][i] ) );
+            maxDifference = jmax( maxDifference, std::abs( filterSpectra[ambiChannel][1][p][i] - sign * filterSpectra[ambiChannel][0][p][i] ) );
+        }
+    }
+    isMirroredChannel[ambiChannel] = ( maxDifference <= 1e-4f * maxMagnitude );
+    isSymmetric = std::all_of( isMirroredChannel.begin(), isMirroredChannel.end(), []( bool mirrored ){ return mirrored; } );
+}
+
+// true if filters are left / right symmetric and symmetric mode enabled
+bool usesSymmetricDecoding() const
+{
+    return enableSymmetricDecoding && isSymmetric;
+}
+
+// decode N_AMBI_CH channels of source (starting at sourceStartChannel), add left / right ears to the first two channels of destination
+void processAndAddTo( const AudioBuffer<float> & source, const int sourceStartChannel, AudioBuffer<float> & destination )
+{
+    // forward transform of each channel into the frequency-domain delay line
+    fdlPos = ( fdlPos + 1 ) % numPartitions;
+    for( int k = 0; k < N_AMBI_CH; k++ )
+    {
+        std::vector<float> & window = inputWindows[k];
+        std::memmove( window.data(), window.data() + blockSize, ( nfft - blockSize ) * sizeof(float) );
+        FloatVectorOperations::copy( window.data() + nfft - blockSize, source.getReadPointer( sourceStartChannel + k ), blockSize );
+        fftBackend.fft( window.data(), inputSpectra[k][fdlPos].data() );
+    }
+    
+    if( usesSymmetricDecoding() )
+    {
+        processSymmetricAndAddTo( destination );
+        return;
+    }
+    
+    // sum over channels and partitions in the frequency domain, one inverse transform per ear
+    for( int earId = 0; earId < 2; earId++ )
+    {
+        ComplexVector<float> & earSpectrum = earSpectra[earId];
+        std::fill( earSpectrum.begin(), earSpectrum.end(), std::complex<float>( 0.f, 0.f ) );
+        for( int k = 0; k < N_AMBI_CH; k++ )
+        {
+            for( int p = 0; p < numPartitions; p++ )
+            {
+                complexMultiplyAccumulate( earSpectrum.data(), inputSpectra[k][( fdlPos + numPartitions - p ) % numPartitions].data(), filterSpectra[k][earId][p].data(), numBins );
+            }
+        }
+        
+        // last blockSize samples are free of circular aliasing
+        fftBackend.ifft( earSpectrum.data(), timeBuffer.data() );
+        destination.addFrom( earId, 0, timeBuffer.data() + nfft - blockSize, blockSize );
+    }
+}
+
+// remove decoding tail
+void reset()
+{
+    for( int k = 0; k < N_AMBI_CH; k++ )
+    {
+        std::fill( inputWindows[k].begin(), inputWindows[k].end(), 0.f );
+        for( auto & spectrum : inputSpectra[k] ){ std::fill( spectrum.begin(), spectrum.end(), std::complex<float>( 0.f, 0.f ) ); }
+    }
+}
+
+private:
+
+// left / right mirroring sign of an Ambisonic channel (ACN): -1 for degree m < 0 (sin(|m| azimuth) terms)
+static int getMirrorSign( const int ambiChannel )
+{
+    int order = (int)std::sqrt( (float)ambiChannel );
+    int degree = ambiChannel - order * ( order + 1 );
+    return ( degree < 0 ) ? -1 : 1;
+}
+
+// symmetric mode: left filters applied to mid (earSpectra[0]) and side (earSpectra[1]) sums
+void processSymmetricAndAddTo( AudioBuffer<float> & destination )
+{
+    for( auto & spectrum : earSpectra ){ std::fill( spectrum.begin(), spectrum.end(), std::complex<float>( 0.f, 0.f ) ); }
+    for( int k = 0; k < N_AMBI_CH; k++ )
+    {
+        ComplexVector<float> & sumSpectrum = earSpectra[ getMirrorSign(k) > 0 ? 0 : 1 ];
+        for( int p = 0; p < numPartitions; p++ )
+        {
+            complexMultiplyAccumulate( sumSpectrum.data(), inputSpectra[k][( fdlPos + numPartitions - p ) % numPartitions].data(), filterSpectra[k][0][p].data(), numBins );
+        }
+    }
+    
+    // left = mid + side, right = mid - side
+    fftBackend.ifft( earSpectra[0].data(), timeBuffer.data() );
+    destination.addFrom( 0, 0, timeBuffer.data() + nfft - blockSize, blockSize );
+    destination.addFrom( 1, 0, timeBuffer.data() + nfft - blockSize, blockSize );
+    fftBackend.ifft( earSpectra[1].data(), timeBuffer.data() );
+    destination.addFrom( 0, 0, timeBuffer.data() + nfft - blockSize, blockSize );
+    destination.addFrom( 1, 0, timeBuffer.data() + nfft - blockSize, blockSize, -1.f );
+}
+
+JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Ambi2BinDecoder)
+
+};
+
+#endif // AMBI2BINDECODER_H_INCLUDED
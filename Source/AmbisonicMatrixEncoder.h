@@ -0,0 +1,110 @@
+#ifndef AMBISONICMATRIXENCODER_H_INCLUDED
+#define AMBISONICMATRIXENCODER_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "Utils.h"
+#include <Eigen/Eigen>
+
+// Ambisonic encoding of all source images at once: source image signals are stacked in a
+// (images x samples) matrix and encoded by a (channels x images) gain matrix, i.e. one
+// matrix product (Eigen blocked GEMM) per block instead of N_AMBI_CH gain passes per image.
+class AmbisonicMatrixEncoder
+{
+
+//==========================================================================
+// ATTRIBUTES
+
+public:
+    
+    using SignalMatrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+private:
+    
+    // gains stored as [numImages x N_AMBI_CH] (row major) are read as a [N_AMBI_CH x numImages] (column major) matrix
+    using GainMatrix = Eigen::Map< const Eigen::Matrix<float, N_AMBI_CH, Eigen::Dynamic> >;
+    
+    SignalMatrix sourceSignals; // one row per source image
+    SignalMatrix encoded; // [N_AMBI_CH x samples]
+    
+    int numSourceImages = 0;
+    int localSamplesPerBlockExpected = 0;
+
+//==========================================================================
+// METHODS
+
+public:
+
+AmbisonicMatrixEncoder() {}
+
+~AmbisonicMatrixEncoder() {}
+
+// local equivalent of prepareToPlay, room made for (at least) maxNumSourceImages source image signals
+void prepareToPlay( const unsigned int samplesPerBlockExpected, const int maxNumSourceImages )
+{
+    localSamplesPerBlockExpected = samplesPerBlockExpected;
+    
+    sourceSignals.setZero( jmax( (int)sourceSignals.rows(), maxNumSourceImages ), samplesPerBlockExpected );
+    encoded.setZero( N_AMBI_CH, samplesPerBlockExpected );
+}
+
+// max number of source image signals
+int getCapacity() const
+{
+    return sourceSignals.rows();
+}
+
+// allocate source image signals for numImages source images (not on the audio thread), to be swapped in by swapSourceSignals
+static SignalMatrix* allocateSourceSignals( const int numImages, const int samplesPerBlockExpected )
+{
+    return new SignalMatrix( SignalMatrix::Zero( numImages, samplesPerBlockExpected ) );
+}
+
+// swap in larger source image signals (allocated for the current block size), no allocation (audio thread safe):
+// the replaced ones are left in grown, to be deleted off the audio thread. Returns true if swapped.
+bool swapSourceSignals( SignalMatrix & grown )
+{
+    if( grown.rows() <= sourceSignals.rows() || grown.cols() != localSamplesPerBlockExpected ){ return false; }
+    sourceSignals.swap( grown );
+    return true;
+}
+
+// set number of source image signals to encode, within capacity (see prepareToPlay / swapSourceSignals), no allocation
+void setNumSourceImages( const int numImages )
+{
+    jassert( numImages <= sourceSignals.rows() );
+    numSourceImages = numImages;
+}
+
+// get pointer to the signal of a given source image, to be filled with localSamplesPerBlockExpected samples before encoding
+float* getSourceImageWritePointer( const int imageId )
+{
+    return sourceSignals.row( imageId ).data();
+}
+
+// source image not to be Ambisonic encoded in current block
+void clearSourceImage( const int imageId )
+{
+    sourceSignals.row( imageId ).setZero();
+}
+
+// encode signals of all source images with constant gains (stored as [numImages x N_AMBI_CH]), add result to
+// Ambisonic channels of destination (starting at destStartChannel). Gain changes within the block are left to
+// the caller (see SourceImagesHandler::addAmbisonicGainsRamp).
+void encodeAndAddTo( AudioBuffer<float> & destination, const int destStartChannel, const float* gains )
+{
+    if( numSourceImages <= 0 ){ return; }
+    
+    encoded.noalias() = GainMatrix( gains, N_AMBI_CH, numSourceImages ) * sourceSignals.topRows( numSourceImages );
+    
+    // add to output
+    for( int k = 0; k < N_AMBI_CH; k++ )
+    {
+        destination.addFrom( destStartChannel + k, 0, encoded.row(k).data(), localSamplesPerBlockExpected );
+    }
+}
+
+JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AmbisonicMatrixEncoder)
+
+};
+
+#endif // AMBISONICMATRIXENCODER_H_INCLUDED
@@ -0,0 +1,220 @@
+#ifndef AURALIZATIONENGINE_H_INCLUDED
+#define AURALIZATIONENGINE_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "OSCHandler.h"
+#include "Ambi2binIRContainer.h"
+#include "Ambi2BinDecoder.h"
+#include "Utils.h" // used to define constants
+#include "DelayLine.h"
+#include "SourceImagesHandler.h"
+#include <atomic>
+
+// Audio processing chain of the auralization engine (delay line, source images, Ambisonic
+// to binaural decoding). Kept independent from GUI and audio device so that it can be run
+// both by the main application and by the offline renderer (see Render directory).
+class AuralizationEngine
+{
+
+//==========================================================================
+// ATTRIBUTES
+
+public:
+    
+    // sources images
+    SourceImagesHandler sourceImagesHandler;
+    
+    // mono input, copied from 1st channel of the buffer given to processAmbisonicBuffer
+    AudioBuffer<float> workingBuffer;
+    
+    // ambisonic buffer holds 2 stereo channels (first) + ambisonic channels
+    AudioBuffer<float> ambisonicBuffer;
+    
+    // longest source image delay (in sec) the delay line is allocated for in prepareToPlay. Longer delays
+    // grow it from the thread calling updateFromOscHandler, never from the audio thread.
+    float maxSceneDelay = 1.f;
+
+private:
+    
+    // misc.
+    double localSampleRate;
+    int localSamplesPerBlockExpected;
+    
+    // delay line
+    DelayLine delayLine;
+    bool requireDelayLineSizeUpdate = false;
+    
+    // Ambisonic to binaural decoding
+    Ambi2binIRContainer ambi2binContainer;
+    Ambi2BinDecoder ambi2binDecoder; // holds current ABIR (room reverb) filters
+    
+    // delay lines fractional delay interpolation, set by the message thread, applied by the audio thread
+    std::atomic<DelayLine::Interpolation> delayInterpolation { DelayLine::Interpolation::Linear };
+    std::atomic<bool> updateDelayInterpolationRequired { false };
+
+//==========================================================================
+// METHODS
+
+public:
+
+AuralizationEngine() {}
+
+~AuralizationEngine() {}
+
+// local equivalent of prepareToPlay
+void prepareToPlay( const unsigned int samplesPerBlockExpected, const double sampleRate )
+{
+    // working buffer
+    workingBuffer.setSize(1, samplesPerBlockExpected);
+    // ambisonic buffer holds 2 stereo channels (first) + ambisonic channels
+    ambisonicBuffer.setSize(2 + N_AMBI_CH, samplesPerBlockExpected);
+    
+    // keep local copies
+    localSampleRate = sampleRate;
+    localSamplesPerBlockExpected = samplesPerBlockExpected;
+    
+    // init delay line
+    delayLine.prepareToPlay(samplesPerBlockExpected, sampleRate);
+    delayLine.setSize(1, getDelayLineLength(maxSceneDelay));
+    sourceImagesHandler.prepareToPlay (samplesPerBlockExpected, sampleRate);
+    
+    // init ambi 2 bin decoding: fill in data in ABIR filtered and ABIR filter themselves
+    ambi2binDecoder.init(samplesPerBlockExpected, AMBI2BIN_IR_LENGTH);
+    for( int i = 0; i < N_AMBI_CH; i++ )
+    {
+        ambi2binDecoder.setImpulseResponse(i, 0, ambi2binContainer.ambi2binIrDict[i][0].data()); // [ch x ear x sampID]
+        ambi2binDecoder.setImpulseResponse(i, 1, ambi2binContainer.ambi2binIrDict[i][1].data()); // [ch x ear x sampID]
+    }
+}
+
+// apply updates flagged from the message thread, to be called at the beginning of each audio block
+void applyPendingUpdates()
+{
+    // delay interpolation change (delay lines are not read by another thread here)
+    if( updateDelayInterpolationRequired.exchange( false, std::memory_order_acquire ) )
+    {
+        DelayLine::Interpolation interpolation = delayInterpolation.load( std::memory_order_relaxed );
+        delayLine.setInterpolation(interpolation);
+        sourceImagesHandler.reverbTail.setDelayInterpolation(interpolation);
+    }
+    
+    // acquire latest scene published from the message thread, if any, resize delay line accordingly
+    if( sourceImagesHandler.applyPendingScene() ){ requireDelayLineSizeUpdate = true; }
+}
+
+// Audio Processing: delay line + source images, fills ambisonicBuffer
+void processAmbisonicBuffer( AudioBuffer<float> *const audioBufferToFill )
+{
+    workingBuffer.copyFrom(0, 0, audioBufferToFill->getWritePointer(0), workingBuffer.getNumSamples());
+    
+    //==========================================================================
+    // SOURCE IMAGE PROCESSING
+    
+    if ( sourceImagesHandler.numSourceImages > 0 )
+    {
+        
+        //==========================================================================
+        // DELAY LINE
+        
+        // swap in delay line grown off the audio thread, if any
+        delayLine.applyPendingCapacity();
+        
+        // update delay line size if need be (within preallocated capacity: no allocation here)
+        if ( requireDelayLineSizeUpdate )
+        {
+            // get maximum required delay line duration
+            float maxDelay = sourceImagesHandler.getMaxDelay();
+            
+            // update delay line size, keep flag up if capacity not grown yet
+            requireDelayLineSizeUpdate = !delayLine.setLength( getDelayLineLength(maxDelay) );
+        }
+        
+        // add current audio buffer to delay line
+        delayLine.copyFrom(0, workingBuffer, 0, 0, workingBuffer.getNumSamples());
+        
+        // loop over sources images, apply delay + room coloration + spatialization
+        sourceImagesHandler.getNextAudioBlock( & delayLine, ambisonicBuffer );
+        
+        // increment delay line write position
+        delayLine.incrementWritePosition(workingBuffer.getNumSamples());
+    
+    }
+
+}
+
+// Audio Processing: Ambisonic to binaural decoding of ambisonicBuffer, result written to audioBufferToFill
+void fillNextAudioBlock( AudioBuffer<float> *const audioBufferToFill )
+{
+    
+    //==========================================================================
+    // SPATIALISATION: Ambisonic decoding + virtual speaker approach + binaural
+    
+    if ( sourceImagesHandler.numSourceImages > 0 )
+    {
+        // direct path (binaural encoded in first two channels) + decoded Ambisonic channels, no intermediate copy
+        audioBufferToFill->copyFrom(0, 0, ambisonicBuffer, 0, 0, workingBuffer.getNumSamples());
+        audioBufferToFill->copyFrom(1, 0, ambisonicBuffer, 1, 0, workingBuffer.getNumSamples());
+        ambi2binDecoder.processAndAddTo(ambisonicBuffer, 2, *audioBufferToFill);
+    }
+    
+    //==========================================================================
+    // if no source image, simply rewrite to output buffer (TODO: remove stupid double copy)
+    else
+    {
+        audioBufferToFill->copyFrom(0, 0, workingBuffer, 0, 0, workingBuffer.getNumSamples());
+        audioBufferToFill->copyFrom(1, 0, workingBuffer, 0, 0, workingBuffer.getNumSamples());
+    }
+}
+
+// update source images based on latest OSC handler internals (to be called from the message
+// thread after oscHandler.updateInternals), applied in next audio loop
+void updateFromOscHandler( OSCHandler & oscHandler )
+{
+    // grow delay line capacity if need be (allocation here rather than in audio thread)
+    delayLine.reserve( getDelayLineLength( getMaxValue( oscHandler.getSourceImageDelays() ) ) );
+    
+    // build new scene from latest received OSC info, handed over to the audio thread
+    sourceImagesHandler.updateFromOscHandler(oscHandler);
+}
+
+// set number of absorption frequency bands (3 or 10), applied in next audio loop
+void setNumFreqBands( const int numBands, OSCHandler & oscHandler )
+{
+    sourceImagesHandler.numFreqBands = numBands;
+    
+    // publish scene with re-dimensioned abs.coeffs, filter bank resized by the audio thread when acquiring it
+    updateFromOscHandler(oscHandler);
+}
+
+// set fractional delay interpolation of source images and reverb tail delay lines, applied in next audio loop
+void setDelayInterpolation( const DelayLine::Interpolation interpolation )
+{
+    delayInterpolation.store( interpolation, std::memory_order_relaxed );
+    
+    // flag update required in audio loop (to avoid multi-thread access issues), after the value it publishes
+    updateDelayInterpolationRequired.store( true, std::memory_order_release );
+}
+
+// clear all "delay line" like buffers
+void clear()
+{
+    delayLine.clear();
+    sourceImagesHandler.reverbTail.clear();
+    sourceImagesHandler.convolutionReverbTail.clear();
+    ambi2binDecoder.reset();
+}
+
+private:
+
+// delay line buffer length required for a given max delay (in sec)
+int getDelayLineLength( const float maxDelay ) const
+{
+    // longest delay creates noisy sound if delay line is exactly 1* its duration
+    return jmax( 2 * localSamplesPerBlockExpected, (int)( 1.5 * maxDelay * localSampleRate ) );
+}
+
+JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AuralizationEngine)
+
+};
+
+#endif // AURALIZATIONENGINE_H_INCLUDED
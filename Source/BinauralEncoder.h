@@ -189,7 +189,13 @@ void setPosition( double azim, double elev)
     crossfadeGain = 0.0f;
     crossfadeOver = false;
 }
-    
+
+// true once the crossfade towards the HRIR of the last setPosition is over
+bool isCrossfadeOver() const
+{
+    return crossfadeOver;
+}
+
 private:
 
 // load a given HRIR set
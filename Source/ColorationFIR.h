@@ -0,0 +1,168 @@
+#ifndef COLORATIONFIR_H_INCLUDED
+#define COLORATIONFIR_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "FIRFilter/FFTBackend.h"
+#include "Utils.h"
+#include <algorithm>
+#include <complex>
+#include <vector>
+
+// Room coloration of a source image with a short minimum-phase FIR instead of the octave filter bank: the FIR is
+// designed once per band gains change (message thread) from its magnitude response, interpolated over the octave
+// band centers, and stored as a spectrum. Source images are then filtered by overlap-save convolution in chunks of
+// firLength samples (FFT of 2*firLength, whatever the block size): no per band filter state, only the last
+// firLength input samples are kept per source image.
+// Frequency resolution is that of the FIR (sampleRate / firLength): lowest octave bands are smoothed together.
+class ColorationFIR
+{
+
+//==========================================================================
+// ATTRIBUTES
+
+public:
+    
+    static const int firLength = 256;
+    static const int nfft = 2 * firLength;
+    static const int numBins = nfft / 2 + 1;
+
+private:
+    
+    FFTBackend fftBackend;
+    std::vector<float> timeBuffer; // fft / ifft buffer
+    ComplexVector<float> spectrum; // input / output spectrum
+    ComplexVector<float> rampedSpectrum; // FIR spectrum of ramping source images (see getRampedSpectrum)
+    
+    // minimum phase design (cepstrum of magnitude response over a finer frequency grid)
+    static const int designSize = 4 * firLength;
+    FFTBackend designFftBackend;
+    std::vector<float> cepstrum;
+    ComplexVector<float> designSpectrum;
+    std::vector<float> fir;
+    
+    double localSampleRate = 0.0;
+
+//==========================================================================
+// METHODS
+
+public:
+
+ColorationFIR() {}
+
+~ColorationFIR() {}
+
+// local equivalent of prepareToPlay (allocates, not to be called from the audio thread), FFT sizes do not depend on block size
+void prepareToPlay( const unsigned int, const double sampleRate )
+{
+    localSampleRate = sampleRate;
+    
+    fftBackend.init( nfft );
+    timeBuffer.assign( nfft, 0.f );
+    spectrum.resize( numBins );
+    rampedSpectrum.resize( numBins );
+    
+    designFftBackend.init( designSize );
+    cepstrum.resize( designSize );
+    designSpectrum.resize( designSize / 2 + 1 );
+    fir.resize( nfft );
+}
+
+// design minimum phase FIR from the gains of numBands (3 or 10) frequency bands, write its spectrum (numBins values,
+// ifft normalization included) to firSpectrum
+void design( const float* bandGains, const int numBands, std::complex<float>* firSpectrum )
+{
+    // log magnitude response: octave band gains (3 bands spread over the octave bands they merge, see from10to3bands)
+    // linearly interpolated in dB over log frequency, floored at -100 dB
+    float logGains[NUM_OCTAVE_BANDS];
+    for( int k = 0; k < NUM_OCTAVE_BANDS; k++ )
+    {
+        int bandId = ( numBands == 3 ) ? ( ( k < 5 ) ? 0 : ( ( k < 9 ) ? 1 : 2 ) ) : k;
+        logGains[k] = std::log( jmax( bandGains[bandId], 1e-5f ) );
+    }
+    for( int i = 0; i <= designSize / 2; i++ )
+    {
+        double freq = i * localSampleRate / designSize;
+        float position = ( freq > 0.0 ) ? jlimit( 0.f, NUM_OCTAVE_BANDS - 1.f, (float)std::log2( freq / 31.5 ) ) : 0.f;
+        int k = jmin( (int)position, NUM_OCTAVE_BANDS - 2 );
+        designSpectrum[i] = logGains[k] + ( position - k ) * ( logGains[k+1] - logGains[k] );
+    }
+    
+    // real cepstrum, folded onto positive quefrencies: exponential of its spectrum is the minimum phase response
+    designFftBackend.ifft( designSpectrum.data(), cepstrum.data() );
+    float scale = 2.f / designSize;
+    cepstrum[0] *= scale;
+    for( int n = 1; n < designSize / 2; n++ ){ cepstrum[n] *= 2.f * scale; }
+    cepstrum[designSize / 2] *= scale;
+    std::fill( cepstrum.begin() + designSize / 2 + 1, cepstrum.end(), 0.f );
+    designFftBackend.fft( cepstrum.data(), designSpectrum.data() );
+    for( auto & value : designSpectrum ){ value = std::exp( value ); }
+    designFftBackend.ifft( designSpectrum.data(), cepstrum.data() );
+    
+    // truncate to firLength (short fade out of the tail), spectrum of zero padded FIR
+    std::fill( fir.begin(), fir.end(), 0.f );
+    const int fadeLength = firLength / 8;
+    for( int n = 0; n < firLength; n++ )
+    {
+        float window = ( n < firLength - fadeLength ) ? 1.f : 0.5f * ( 1.f + std::cos( M_PI * ( n - firLength + fadeLength + 1 ) / ( fadeLength + 1 ) ) );
+        fir[n] = cepstrum[n] * scale * window;
+    }
+    FloatVectorOperations::multiply( fir.data(), 2.f / nfft, firLength );
+    fftBackend.fft( fir.data(), firSpectrum );
+}
+
+// spectrum value (all bins) of the FIR of a broadband gain, ifft normalization included (see design)
+static std::complex<float> getFlatSpectrum( const float gain )
+{
+    return gain * 2.f / nfft;
+}
+
+// FIR spectrum at a given ramp position between start (0) and target (1) spectra, valid until next call
+const std::complex<float>* getRampedSpectrum( const std::complex<float>* start, const std::complex<float>* target, const float position )
+{
+    for( int i = 0; i < numBins; i++ ){ rampedSpectrum[i] = start[i] + position * ( target[i] - start[i] ); }
+    return rampedSpectrum.data();
+}
+
+// filter numSamples of data in place with the FIR of firSpectrum (see design). history holds the last firLength
+// input samples of the source image (to be cleared before first use), updated here.
+void process( float* data, const int numSamples, float* history, const std::complex<float>* firSpectrum )
+{
+    for( int start = 0; start < numSamples; start += firLength )
+    {
+        int chunkSize = jmin( firLength, numSamples - start );
+        
+        // overlap-save: last firLength input samples then the chunk, at the end of the fft window
+        std::fill( timeBuffer.begin(), timeBuffer.begin() + firLength - chunkSize, 0.f );
+        FloatVectorOperations::copy( timeBuffer.data() + firLength - chunkSize, history, firLength );
+        FloatVectorOperations::copy( timeBuffer.data() + nfft - chunkSize, data + start, chunkSize );
+        FloatVectorOperations::copy( history, timeBuffer.data() + nfft - firLength, firLength );
+        fftBackend.fft( timeBuffer.data(), spectrum.data() );
+        
+        // filter, last chunkSize samples are free of circular aliasing
+        multiply( spectrum.data(), firSpectrum );
+        fftBackend.ifft( spectrum.data(), timeBuffer.data() );
+        FloatVectorOperations::copy( data + start, timeBuffer.data() + nfft - chunkSize, chunkSize );
+    }
+}
+
+private:
+
+// x[i] *= h[i] for numBins complex values (explicit real / imaginary parts, see complexMultiplyAccumulate)
+static void multiply( std::complex<float>* x, const std::complex<float>* h )
+{
+    float* xf = reinterpret_cast<float*>(x);
+    const float* hf = reinterpret_cast<const float*>(h);
+    for( int i = 0; i < 2 * numBins; i += 2 )
+    {
+        float real = xf[i] * hf[i] - xf[i + 1] * hf[i + 1];
+        xf[i + 1] = xf[i] * hf[i + 1] + xf[i + 1] * hf[i];
+        xf[i] = real;
+    }
+}
+
+// copyable: one per worker (see SourceImagesHandler::processingContextStruct)
+JUCE_LEAK_DETECTOR (ColorationFIR)
+
+};
+
+#endif // COLORATIONFIR_H_INCLUDED
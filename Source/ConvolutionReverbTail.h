@@ -0,0 +1,103 @@
+#ifndef CONVOLUTIONREVERBTAIL_H_INCLUDED
+#define CONVOLUTIONREVERBTAIL_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "FIRFilter/PartitionedConvolver.h"
+#include "Utils.h"
+
+// Reverb tail based on a measured Ambisonic room impulse response (ambiX: ACN channel order, SN3D
+// normalization), used in place of the FDN reverb tail when loaded. Convolution is zero latency,
+// long impulse response segments are computed on background threads (see PartitionedConvolver).
+class ConvolutionReverbTail
+{
+
+//==========================================================================
+// ATTRIBUTES
+
+private:
+    
+    AudioBuffer<float> impulseResponse; // as loaded from file
+    double impulseResponseSampleRate = 0.0;
+    
+    PartitionedConvolver convolver;
+    AudioBuffer<float> outputBuffer; // one channel per Ambisonic channel of the impulse response
+    
+    int localSamplesPerBlockExpected = 0;
+
+//==========================================================================
+// METHODS
+
+public:
+
+ConvolutionReverbTail() {}
+
+~ConvolutionReverbTail() {}
+
+// load Ambisonic room impulse response (up to N_AMBI_CH channels used), applied at next prepareToPlay
+bool loadFile( const File & file )
+{
+    AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+    ScopedPointer<AudioFormatReader> reader = formatManager.createReaderFor( file );
+    if( reader == nullptr ){ return false; }
+    
+    impulseResponse.setSize( jmin( (int)reader->numChannels, N_AMBI_CH ), (int)reader->lengthInSamples );
+    reader->read( &impulseResponse, 0, (int)reader->lengthInSamples, 0, true, true );
+    impulseResponseSampleRate = reader->sampleRate;
+    return true;
+}
+
+// local equivalent of prepareToPlay (allocates and starts convolver threads, not to be called from audio thread)
+void prepareToPlay( const unsigned int samplesPerBlockExpected, const double sampleRate )
+{
+    localSamplesPerBlockExpected = samplesPerBlockExpected;
+    
+    int numChannels = impulseResponse.getNumChannels();
+    if( numChannels == 0 ){ return; }
+    
+    // resample impulse response to audio device sample rate if need be
+    AudioBuffer<float> ir = impulseResponse;
+    if( impulseResponseSampleRate != sampleRate )
+    {
+        double speedRatio = impulseResponseSampleRate / sampleRate;
+        int numSamples = (int)( impulseResponse.getNumSamples() / speedRatio );
+        ir.setSize( numChannels, numSamples );
+        for( int k = 0; k < numChannels; k++ )
+        {
+            LagrangeInterpolator interpolator;
+            interpolator.process( speedRatio, impulseResponse.getReadPointer(k), ir.getWritePointer(k), numSamples );
+        }
+    }
+    
+    outputBuffer.setSize( numChannels, samplesPerBlockExpected );
+    convolver.init( samplesPerBlockExpected, ir.getNumSamples(), numChannels );
+    for( int k = 0; k < numChannels; k++ ){ convolver.setImpulseResponse( k, ir.getReadPointer(k) ); }
+}
+
+// true if an impulse response has been loaded and prepared
+bool isActive() const
+{
+    return convolver.getNumChannels() > 0;
+}
+
+// convolve mono input with impulse response, add result to Ambisonic channels of destination (starting at destStartChannel)
+void processAndAddTo( const float* input, AudioBuffer<float> & destination, const int destStartChannel, const float gain )
+{
+    convolver.process( input, outputBuffer.getArrayOfWritePointers() );
+    for( int k = 0; k < outputBuffer.getNumChannels(); k++ )
+    {
+        destination.addFrom( destStartChannel + k, 0, outputBuffer, k, 0, localSamplesPerBlockExpected, gain );
+    }
+}
+
+// remove convolution tail
+void clear()
+{
+    if( isActive() ){ convolver.reset(); }
+}
+
+JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ConvolutionReverbTail)
+
+};
+
+#endif // CONVOLUTIONREVERBTAIL_H_INCLUDED
@@ -0,0 +1,92 @@
+#ifndef CPUBUDGETCONTROLLER_H_INCLUDED
+#define CPUBUDGETCONTROLLER_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+// Audio callback time measurement against a CPU budget: the processing time of each block (high resolution timer,
+// see startBlock / endBlock) is compared to a target fraction of the block duration, and getAdjustment tells the
+// caller to make its processing cheaper or allows it to get back some detail. The load follows peaks right away and
+// decays slowly, adjustments are spaced by holdBlocks so that the effect of the previous one (ramps included) is
+// measured before the next one. Audio thread only, settings aside.
+class CpuBudgetController
+{
+
+//==========================================================================
+// ATTRIBUTES
+
+public:
+    
+    // target processing time, as a fraction of the block duration (0: no control)
+    float targetLoad = 0.f;
+    
+    // detail given back once the load falls below lowLoadRatio * targetLoad (hysteresis)
+    float lowLoadRatio = 0.7f;
+    
+    // minimum number of blocks between two adjustments
+    int holdBlocks = 20;
+
+private:
+    
+    double blockDuration = 0.0; // in sec
+    int64 startTicks = 0;
+    float load = 0.f; // smoothed processing time / block duration
+    int blocksSinceAdjustment = 0;
+
+//==========================================================================
+// METHODS
+
+public:
+
+CpuBudgetController() {}
+
+~CpuBudgetController() {}
+
+// local equivalent of prepareToPlay
+void prepareToPlay( const unsigned int samplesPerBlockExpected, const double sampleRate )
+{
+    blockDuration = samplesPerBlockExpected / sampleRate;
+    load = 0.f;
+    blocksSinceAdjustment = 0;
+}
+
+bool isEnabled() const
+{
+    return targetLoad > 0.f;
+}
+
+// to be called right before / after the processing of a block
+void startBlock()
+{
+    startTicks = Time::getHighResolutionTicks();
+}
+
+void endBlock()
+{
+    float blockLoad = Time::highResolutionTicksToSeconds( Time::getHighResolutionTicks() - startTicks ) / blockDuration;
+    load = ( blockLoad > load ) ? blockLoad : load + 0.1f * ( blockLoad - load );
+    blocksSinceAdjustment++;
+}
+
+// smoothed processing time of last blocks, as a fraction of the block duration
+float getLoad() const
+{
+    return load;
+}
+
+// +1 if processing is to be made cheaper (over budget), -1 if it can afford more detail, 0 otherwise
+int getAdjustment()
+{
+    if( !isEnabled() || blocksSinceAdjustment < holdBlocks ){ return 0; }
+    
+    int adjustment = 0;
+    if( load > targetLoad ){ adjustment = 1; }
+    else if( load < lowLoadRatio * targetLoad ){ adjustment = -1; }
+    if( adjustment != 0 ){ blocksSinceAdjustment = 0; }
+    return adjustment;
+}
+
+JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CpuBudgetController)
+
+};
+
+#endif // CPUBUDGETCONTROLLER_H_INCLUDED
@@ -1,5 +1,9 @@
 #pragma once
 
+#include "SimdFloat4.h"
+#include <atomic>
+#include <memory>
+
 class DelayLine
 {
     
@@ -7,17 +11,40 @@ class DelayLine
 // ATTRIBUTES
     
 public:
-    
+
+// fractional delay interpolation used by all reads
+enum class Interpolation
+{
+    Linear, // 2 points
+    Lagrange3, // 3rd order Lagrange, 4 points
+    Thiran, // 1st order allpass, needs per tap state (see fillBufferWithDelayedTaps)
+    WindowedSinc // polyphase windowed-sinc table, sincKernelSize points
+};
+
+// maximum number of taps read at once by fillBufferWithDelayedTaps
+static const int maxNumTaps = 8;
+
+// windowed-sinc kernel length and number of tabulated fractional delays
+static const int sincKernelSize = 16;
+static const int sincNumPhases = 512;
+
 private:
 
 int writeIndex;
 int futureLineSize;
 unsigned int localSamplesPerBlockExpected = 0;
-    
-AudioBuffer<float> buffer;
 
-AudioBuffer<float> chunkBufferPrev;
-AudioBuffer<float> chunkBufferNext;
+// circular buffer: the line uses the first length samples of the buffer (capacity), so that its length can change
+// without allocation on the audio thread. Capacity grows by buffers allocated off the audio thread (see reserve).
+std::unique_ptr< AudioBuffer<float> > buffer;
+int length = 0;
+int numChannels = 0;
+int reservedCapacity = 0; // capacity of the latest buffer allocated by reserve (message thread side)
+std::atomic< AudioBuffer<float>* > pendingBuffer { nullptr }; // grown buffer, waiting to be swapped in by the audio thread
+std::atomic< AudioBuffer<float>* > retiredBuffer { nullptr }; // replaced buffer, waiting to be deleted off the audio thread
+
+Interpolation interpolation = Interpolation::Linear;
+std::vector<float> sincTable; // [(sincNumPhases+1) x sincKernelSize], one kernel per fractional delay
 
 //==========================================================================
 // METHODS
@@ -28,60 +55,121 @@ DelayLine()
 {
     writeIndex = 0;
     futureLineSize = 0;
+    buffer.reset( new AudioBuffer<float>() );
+    
+    initSincTable();
 }
 
-~DelayLine() {}
+~DelayLine()
+{
+    delete pendingBuffer.exchange( nullptr );
+    delete retiredBuffer.exchange( nullptr );
+}
 
 // local equivalent of prepareToPlay
 void prepareToPlay(const unsigned int samplesPerBlockExpected, const double sampleRate)
 {
     localSamplesPerBlockExpected = samplesPerBlockExpected;
-    buffer.clear();
-    
-    chunkBufferPrev.setSize(1, samplesPerBlockExpected);
-    chunkBufferNext.setSize(1, samplesPerBlockExpected);
+    buffer->clear();
 }
 
-// set delay line size
+// allocate delay line of newNumSamples (capacity and length), existing content kept.
+// Allocates: not to be called while the audio thread runs (see setLength / reserve for that)
 void setSize(const unsigned int newNumChannels, unsigned int newNumSamples)
 {
-    // update number of channels (split to simplify code reading)
-    if( newNumChannels != buffer.getNumChannels() )
-    {
-        buffer.setSize(newNumChannels, buffer.getNumSamples(), true, true);
-    }
+    delete pendingBuffer.exchange( nullptr );
+    
+    buffer->setSize(newNumChannels, newNumSamples, true, true);
+    numChannels = newNumChannels;
+    length = newNumSamples;
+    reservedCapacity = newNumSamples;
+    futureLineSize = 0;
+    writeIndex %= jmax( 1, length );
+}
+
+// set delay line length within current capacity, no allocation (audio thread). Returns false if newNumSamples
+// exceeds capacity, in which case the length is set to capacity (see reserve to grow capacity)
+bool setLength(unsigned int newNumSamples)
+{
+    int capacity = buffer->getNumSamples();
+    int newLength = jmin( (int)newNumSamples, capacity );
     
-    // update num samples: increased size -> zero pad at end
-    if( newNumSamples > buffer.getNumSamples() )
+    // update num samples: increased size -> zero pad at end (clear leftovers of a previous, longer line)
+    if( newLength > length )
     {
-        buffer.setSize(newNumChannels, newNumSamples, true, true);
+        for( int ch = 0; ch < numChannels; ch++ ){ buffer->clear(ch, length, newLength - length); }
+        length = newLength;
+        futureLineSize = 0;
     }
     
     // update num samples: decreased size -> flag reduction, will happen next time writeIndex is reset
-    else if( newNumSamples < buffer.getNumSamples() && newNumSamples >= localSamplesPerBlockExpected )
+    else if( newLength < length && newLength >= (int)localSamplesPerBlockExpected )
     {
-        futureLineSize = newNumSamples;
+        futureLineSize = newLength;
     }
+    
+    // same size: cancel pending reduction
+    else if( newLength == length ){ futureLineSize = 0; }
+    
+    return newLength == (int)newNumSamples;
+}
+
+// make sure capacity will be at least newCapacity samples: allocates a larger buffer if need be, handed over to the
+// audio thread at its next applyPendingCapacity call. To be called from a non real-time (e.g. message) thread.
+void reserve(const unsigned int newCapacity)
+{
+    // delete buffer replaced by the last hand over
+    delete retiredBuffer.exchange( nullptr );
+    
+    if( (int)newCapacity <= reservedCapacity ){ return; }
+    reservedCapacity = newCapacity;
+    
+    AudioBuffer<float>* grownBuffer = new AudioBuffer<float>(numChannels, newCapacity);
+    grownBuffer->clear();
+    
+    // replace a grown buffer not yet handed over, if any
+    delete pendingBuffer.exchange( grownBuffer );
+}
+
+// swap in the buffer grown by reserve, if any (audio thread, at the beginning of a block: not while the line is read)
+void applyPendingCapacity()
+{
+    // previous buffer not deleted yet: hand over at a later block
+    if( retiredBuffer.load() != nullptr ){ return; }
+    
+    AudioBuffer<float>* grownBuffer = pendingBuffer.exchange( nullptr );
+    if( grownBuffer == nullptr ){ return; }
+    
+    // same length: circular buffer content keeps its position
+    for( int ch = 0; ch < numChannels; ch++ ){ grownBuffer->copyFrom(ch, 0, *buffer, ch, 0, length); }
+    retiredBuffer.store( buffer.release() );
+    buffer.reset( grownBuffer );
+}
+
+// current number of allocated samples per channel
+int getCapacity() const
+{
+    return buffer->getNumSamples();
 }
 
 // add samples from buffer to delay line (replace)
 void copyFrom(const unsigned int destChannel, const juce::AudioBuffer<float> & source, const unsigned int sourceChannel, const unsigned int sourceStartSample, const unsigned int numSamples)
 {
     // make sure delay line is long enough
-    jassert( numSamples <= buffer.getNumSamples() );
+    jassert( numSamples <= length );
     
     // either simple copy
-    if ( writeIndex + numSamples <= buffer.getNumSamples() )
+    if ( writeIndex + numSamples <= length )
     {
-        buffer.copyFrom(destChannel, writeIndex, source, sourceChannel, 0, numSamples);
+        buffer->copyFrom(destChannel, writeIndex, source, sourceChannel, 0, numSamples);
     }
     
     // or circular copy (last samples of audio buffer will go at delay line buffer begining)
     else
     {
-        int numSamplesTail = buffer.getNumSamples() - writeIndex;
-        buffer.copyFrom(destChannel, writeIndex, source, sourceChannel, 0, numSamplesTail);
-        buffer.copyFrom(destChannel, 0, source, sourceChannel, numSamplesTail, numSamples - numSamplesTail);
+        int numSamplesTail = length - writeIndex;
+        buffer->copyFrom(destChannel, writeIndex, source, sourceChannel, 0, numSamplesTail);
+        buffer->copyFrom(destChannel, 0, source, sourceChannel, numSamplesTail, numSamples - numSamplesTail);
     }
 }
 
@@ -89,20 +177,20 @@ void copyFrom(const unsigned int destChannel, const juce::AudioBuffer<float> & s
 void addFrom(const unsigned int destChannel, const AudioBuffer<float> & source, const unsigned int sourceChannel, const unsigned int sourceStartSample, const unsigned int numSamples)
 {
     // make sure delay line is long enough
-    jassert( numSamples <= buffer.getNumSamples() );
+    jassert( numSamples <= length );
     
     // either simple copy
-    if ( writeIndex + numSamples <= buffer.getNumSamples() )
+    if ( writeIndex + numSamples <= length )
     {
-        buffer.addFrom(destChannel, writeIndex, source, sourceChannel, 0, numSamples);
+        buffer->addFrom(destChannel, writeIndex, source, sourceChannel, 0, numSamples);
     }
     
     // or circular copy (last samples of audio buffer will go at delay line buffer begining)
     else
     {
-        int numSamplesTail = buffer.getNumSamples() - writeIndex;
-        buffer.addFrom(destChannel, writeIndex, source, sourceChannel, 0, numSamplesTail);
-        buffer.addFrom(destChannel, 0, source, sourceChannel, numSamplesTail, numSamples - numSamplesTail);
+        int numSamplesTail = length - writeIndex;
+        buffer->addFrom(destChannel, writeIndex, source, sourceChannel, 0, numSamplesTail);
+        buffer->addFrom(destChannel, 0, source, sourceChannel, numSamplesTail, numSamples - numSamplesTail);
     }
 }
 
@@ -112,8 +200,8 @@ void incrementWritePosition(const unsigned int numSamples)
     // delay line size reduction flagged earlier: reduce size now
     if( futureLineSize > 0 && writeIndex >= futureLineSize )
     {
-        // update size
-        buffer.setSize(buffer.getNumChannels(), futureLineSize, true, true);
+        // update size (no reallocation)
+        length = futureLineSize;
         
         // reset flag
         futureLineSize = 0;
@@ -121,58 +209,436 @@ void incrementWritePosition(const unsigned int numSamples)
     
     // increment (modulo) write position
     writeIndex += numSamples;
-    writeIndex %= buffer.getNumSamples();
+    writeIndex %= length;
+}
+
+// set fractional delay interpolation, not to be called while another thread reads the delay line
+void setInterpolation( const Interpolation newInterpolation )
+{
+    interpolation = newInterpolation;
+}
+
+Interpolation getInterpolation() const
+{
+    return interpolation;
+}
+
+// interpolation names, as used in command line options
+static String getInterpolationName( const Interpolation type )
+{
+    switch( type )
+    {
+        case Interpolation::Lagrange3: return "lagrange3";
+        case Interpolation::Thiran: return "thiran";
+        case Interpolation::WindowedSinc: return "sinc";
+        default: return "linear";
+    }
+}
+
+// get interpolation from its name, return false if name unknown
+static bool getInterpolationFromName( const String & name, Interpolation & type )
+{
+    for( Interpolation candidate : { Interpolation::Linear, Interpolation::Lagrange3, Interpolation::Thiran, Interpolation::WindowedSinc } )
+    {
+        if( name == getInterpolationName( candidate ) ){ type = candidate; return true; }
+    }
+    return false;
+}
+
+// get interpolated delayed buffer out of delay line (Thiran falls back to linear interpolation: no allpass state here)
+void fillBufferWithDelayedChunk( AudioBuffer<float> & destination, const unsigned int destChannel, const unsigned int destStartSample, const unsigned int sourceChannel, const float delayInSamples, const float numSamples ) const
+{
+    const float gain = 1.f;
+    fillBufferWithDelayedTaps( destination.getWritePointer(destChannel, destStartSample), sourceChannel, &delayInSamples, &gain, 1, (int)numSamples );
+}
+
+// same as above, with the allpass state of this read (one float, kept by the caller from one block to the next)
+void fillBufferWithDelayedChunk( AudioBuffer<float> & destination, const unsigned int destChannel, const unsigned int destStartSample, const unsigned int sourceChannel, const float delayInSamples, const float numSamples, float & allpassState ) const
+{
+    const float gain = 1.f;
+    fillBufferWithDelayedTaps( destination.getWritePointer(destChannel, destStartSample), sourceChannel, &delayInSamples, &gain, 1, (int)numSamples, &allpassState );
+}
+
+// multi-tap read: destination = sum of numTaps fractional delay taps read from sourceChannel, each scaled by its gain
+// (replace). FIR interpolated taps are read in a single pass over destination: the block is split in segments where
+// no kernel point wraps around the circular buffer, so that the inner loop runs without per sample branching.
+// Thiran (recursive) taps need one allpass state per tap in allpassStates, kept by the caller from one block to the
+// next (linear interpolation is used if allpassStates is null).
+// Does not modify the delay line: safe to call from several threads at once, each with its own destination.
+void fillBufferWithDelayedTaps( float* destination, const unsigned int sourceChannel, const float* delaysInSamples, const float* gains, const int numTaps, const int numSamples, float* allpassStates = nullptr ) const
+{
+    jassert( numTaps <= maxNumTaps );
+    
+    // integer delays only: all interpolators reduce to a plain (1 point) read
+    bool integerDelays = true;
+    for( int t = 0; t < numTaps; t++ ){ integerDelays = integerDelays && delaysInSamples[t] == std::floor( delaysInSamples[t] ); }
+    
+    if( integerDelays )
+    {
+        readFirTaps<1>( destination, sourceChannel, delaysInSamples, gains, numTaps, numSamples );
+        
+        // allpass output is then the delayed input itself: keep states up to date
+        if( interpolation == Interpolation::Thiran && allpassStates != nullptr )
+        {
+            const int lineSize = length;
+            for( int t = 0; t < numTaps; t++ )
+            {
+                int index = writeIndex - (int)delaysInSamples[t] + numSamples - 1;
+                allpassStates[t] = buffer->getReadPointer( sourceChannel )[ ( index % lineSize + lineSize ) % lineSize ];
+            }
+        }
+        return;
+    }
+    
+    switch( interpolation )
+    {
+        case Interpolation::Lagrange3:
+            readFirTaps<4>( destination, sourceChannel, delaysInSamples, gains, numTaps, numSamples );
+            break;
+        case Interpolation::WindowedSinc:
+            readFirTaps<sincKernelSize>( destination, sourceChannel, delaysInSamples, gains, numTaps, numSamples );
+            break;
+        case Interpolation::Thiran:
+            if( allpassStates != nullptr ){ readAllpassTaps( destination, sourceChannel, delaysInSamples, gains, numTaps, numSamples, allpassStates ); break; }
+        default:
+            readFirTaps<2>( destination, sourceChannel, delaysInSamples, gains, numTaps, numSamples );
+    }
+}
+
+// single tap read at a delay ramped linearly along the block, from delayStart (reached one sample before the block)
+// to delayEnd (reached at its last sample), scaled by gain (replace). Moving the read position instead of crossfading
+// two fixed taps gives a continuous pitch shift (Doppler) rather than comb filtering. allpassState: see above.
+void fillBufferWithRampedDelay( float* destination, const unsigned int sourceChannel, const float delayStart, const float delayEnd, const float gain, const int numSamples, float* allpassState = nullptr ) const
+{
+    if( delayStart == delayEnd ){ fillBufferWithDelayedTaps( destination, sourceChannel, &delayEnd, &gain, 1, numSamples, allpassState ); return; }
+    
+    switch( interpolation )
+    {
+        case Interpolation::Lagrange3:
+            readRampedTap<4>( destination, sourceChannel, delayStart, delayEnd, gain, numSamples );
+            break;
+        case Interpolation::WindowedSinc:
+            readRampedTap<sincKernelSize>( destination, sourceChannel, delayStart, delayEnd, gain, numSamples );
+            break;
+        case Interpolation::Thiran:
+            if( allpassState != nullptr ){ readRampedAllpassTap( destination, sourceChannel, delayStart, delayEnd, gain, numSamples, *allpassState ); break; }
+        default:
+            readRampedTap<2>( destination, sourceChannel, delayStart, delayEnd, gain, numSamples );
+    }
+}
+
+private:
+
+// interpolation kernel of kernelSize points for a given delay: point k is read at delay delayInt - (kernelSize-1)/2 + k.
+// Delays too short for the kernel to be causal are rounded down to an integer delay.
+template <int kernelSize>
+void getKernel( float delay, int & delayInt, float* coefs ) const
+{
+    if( delay < ( kernelSize - 1 ) / 2 ){ delay = std::floor( delay ); }
+    delayInt = (int)delay;
+    float frac = delay - delayInt;
+    
+    if( kernelSize == 1 ){ coefs[0] = 1.f; }
+    else if( kernelSize == 2 ){ coefs[0] = 1.f - frac; coefs[1] = frac; }
+    else if( kernelSize == 4 )
+    {
+        // Lagrange polynomial through points 0..3, evaluated at 1+frac
+        float d = 1.f + frac;
+        coefs[0] = -( d - 1.f ) * ( d - 2.f ) * ( d - 3.f ) / 6.f;
+        coefs[1] = d * ( d - 2.f ) * ( d - 3.f ) / 2.f;
+        coefs[2] = -d * ( d - 1.f ) * ( d - 3.f ) / 2.f;
+        coefs[3] = d * ( d - 1.f ) * ( d - 2.f ) / 6.f;
+    }
+    else
+    {
+        // nearest tabulated fractional delay
+        int phase = (int)( frac * sincNumPhases + 0.5f );
+        const float* kernel = sincTable.data() + phase * sincKernelSize;
+        for( int k = 0; k < kernelSize; k++ ){ coefs[k] = kernel[k]; }
+    }
+}
+
+// FIR interpolated multi-tap read (see fillBufferWithDelayedTaps)
+template <int kernelSize>
+void readFirTaps( float* destination, const unsigned int sourceChannel, const float* delaysInSamples, const float* gains, const int numTaps, const int numSamples ) const
+{
+    const int lineSize = length;
+    const float* line = buffer->getReadPointer( sourceChannel );
+    const int numPoints = numTaps * kernelSize;
+    
+    // read positions and gains of all kernel points of all taps
+    int indices[maxNumTaps * kernelSize];
+    float coefs[maxNumTaps * kernelSize];
+    for( int t = 0; t < numTaps; t++ )
+    {
+        // if after an update the delay goes fetch too far: clamp to oldest samples
+        float delay = jlimit( 0.f, (float)( lineSize - kernelSize - 1 ), delaysInSamples[t] );
+        int delayInt;
+        getKernel<kernelSize>( delay, delayInt, coefs + t * kernelSize );
+        
+        for( int k = 0; k < kernelSize; k++ )
+        {
+            int index = writeIndex - ( delayInt - ( kernelSize - 1 ) / 2 + k );
+            indices[t * kernelSize + k] = ( index % lineSize + lineSize ) % lineSize;
+            coefs[t * kernelSize + k] *= gains[t];
+        }
+    }
+    
+    const float* pointers[maxNumTaps * kernelSize];
+    int sampleId = 0;
+    while( sampleId < numSamples )
+    {
+        // longest segment without wrap around for any point
+        int segmentLength = numSamples - sampleId;
+        for( int p = 0; p < numPoints; p++ )
+        {
+            segmentLength = jmin( segmentLength, lineSize - indices[p] );
+            pointers[p] = line + indices[p];
+        }
+        
+        sumPoints( destination + sampleId, pointers, coefs, numPoints, segmentLength );
+        
+        // move on to next segment
+        for( int p = 0; p < numPoints; p++ )
+        {
+            indices[p] += segmentLength;
+            if( indices[p] == lineSize ){ indices[p] = 0; }
+        }
+        sampleId += segmentLength;
+    }
 }
 
-// get delayed buffer out of delay line
-void _fillBufferWithDelayedChunk( AudioBuffer<float> & destination, const unsigned int destChannel, const unsigned int destStartSample, const unsigned int sourceChannel, const unsigned int delayInSamples, const unsigned int numSamples )
+// destination[i] = sum over points of coefs[p] * points[p][i], on contiguous segments
+static void sumPoints( float* destination, const float* const* points, const float* coefs, const int numPoints, const int numSamples )
 {
+    int i = 0;
+
+#if SIMD_FLOAT4
+    float4 coefs4[maxNumTaps * sincKernelSize];
+    for( int p = 0; p < numPoints; p++ ){ coefs4[p] = set4( coefs[p] ); }
     
-    int writePos = writeIndex - delayInSamples;
+    for( ; i + 4 <= numSamples; i += 4 )
+    {
+        float4 sum = set4( 0.f );
+        for( int p = 0; p < numPoints; p++ ){ sum = madd4( coefs4[p], load4( points[p] + i ), sum ); }
+        store4( destination + i, sum );
+    }
+#endif
     
-    if ( writePos < 0 )
+    for( ; i < numSamples; i++ )
     {
-        writePos = buffer.getNumSamples() + writePos;
-        if ( writePos < 0 ) // if after an update the first delay force to go fetch far to far: not best option yet (to set write pointer to zero)
-            writePos = 0;
+        float sum = 0.f;
+        for( int p = 0; p < numPoints; p++ ){ sum += coefs[p] * points[p][i]; }
+        destination[i] = sum;
     }
+}
+
+// FIR interpolated ramped read (see fillBufferWithRampedDelay): kernel recomputed for each sample, dot product with
+// the kernelSize samples around the read position. Samples are read in place unless the read range of the block
+// wraps around the circular buffer (then gathered with modulo, rare).
+template <int kernelSize>
+void readRampedTap( float* destination, const unsigned int sourceChannel, float delayStart, float delayEnd, const float gain, const int numSamples ) const
+{
+    const int lineSize = length;
+    const float* line = buffer->getReadPointer( sourceChannel );
+    const int newestOffset = ( kernelSize - 1 ) / 2;
+    
+    // delays for which the kernel is causal and within the delay line
+    const float minDelay = (float)newestOffset;
+    const float maxDelay = (float)( lineSize - numSamples - kernelSize - 1 );
+    delayStart = jlimit( minDelay, maxDelay, delayStart );
+    delayEnd = jlimit( minDelay, maxDelay, delayEnd );
+    const double delayStep = ( (double)delayEnd - delayStart ) / numSamples;
     
-    if ( ( writePos + numSamples ) < buffer.getNumSamples() )
+    // range of read indices (oldest point at largest delay, newest point at smallest delay)
+    const int firstIndex = writeIndex - (int)std::ceil( jmax( delayStart, delayEnd ) ) - kernelSize;
+    const int lastIndex = writeIndex + numSamples + newestOffset - (int)jmin( delayStart, delayEnd );
+    const bool wraps = firstIndex < 0 || lastIndex >= lineSize;
+    
+    float coefs[kernelSize]; // oldest point first
+    float window[kernelSize];
+    for( int i = 0; i < numSamples; i++ )
     {
-        // simple copy
-        destination.copyFrom(destChannel, destStartSample, buffer, sourceChannel, writePos, numSamples);
+        double delay = delayStart + ( i + 1 ) * delayStep;
+        int delayInt = (int)delay;
+        getRampKernel<kernelSize>( (float)( delay - delayInt ), coefs );
+        
+        // kernelSize samples up to the newest point, in increasing time order
+        int oldestIndex = writeIndex + i - delayInt + newestOffset - ( kernelSize - 1 );
+        const float* samples = line + oldestIndex;
+        if( wraps )
+        {
+            for( int k = 0; k < kernelSize; k++ ){ window[k] = line[ ( oldestIndex + k + lineSize ) % lineSize ]; }
+            samples = window;
+        }
+        
+        destination[i] = gain * dotProduct<kernelSize>( coefs, samples );
+    }
+}
+
+// kernel of getKernel, oldest point first (i.e. reversed)
+template <int kernelSize>
+void getRampKernel( const float frac, float* coefs ) const
+{
+    if( kernelSize == 2 ){ coefs[0] = frac; coefs[1] = 1.f - frac; }
+    else if( kernelSize == 4 )
+    {
+        float d = 1.f + frac;
+        coefs[3] = -( d - 1.f ) * ( d - 2.f ) * ( d - 3.f ) / 6.f;
+        coefs[2] = d * ( d - 2.f ) * ( d - 3.f ) / 2.f;
+        coefs[1] = -d * ( d - 1.f ) * ( d - 3.f ) / 2.f;
+        coefs[0] = d * ( d - 1.f ) * ( d - 2.f ) / 6.f;
     }
     else
     {
-        // circular loop
-        int numSamplesTail = buffer.getNumSamples() - writePos;
-        destination.copyFrom(destChannel, destStartSample, buffer, sourceChannel, writePos, numSamplesTail );
-        destination.copyFrom(destChannel, destStartSample + numSamplesTail, buffer, sourceChannel, 0, numSamples - numSamplesTail);
+        // windowed-sinc kernels are symmetric: reversed kernel of frac is the kernel of 1 - frac
+        int phase = sincNumPhases - (int)( frac * sincNumPhases + 0.5f );
+        const float* kernel = sincTable.data() + phase * sincKernelSize;
+        for( int k = 0; k < kernelSize; k++ ){ coefs[k] = kernel[k]; }
+    }
+}
+
+template <int kernelSize>
+static float dotProduct( const float* a, const float* b )
+{
+#if SIMD_FLOAT4
+    if( kernelSize % 4 == 0 )
+    {
+        float4 sum = mul4( load4( a ), load4( b ) );
+        for( int k = 4; k < kernelSize; k += 4 ){ sum = madd4( load4( a + k ), load4( b + k ), sum ); }
+        return sum4( sum );
     }
+#endif
+    float sum = 0.f;
+    for( int k = 0; k < kernelSize; k++ ){ sum += a[k] * b[k]; }
+    return sum;
+}
+
+// Thiran ramped read: allpass coefficient and integer delay updated for each sample (scalar, recursive)
+void readRampedAllpassTap( float* destination, const unsigned int sourceChannel, float delayStart, float delayEnd, const float gain, const int numSamples, float & state ) const
+{
+    const int lineSize = length;
+    const float* line = buffer->getReadPointer( sourceChannel );
     
+    const float maxDelay = (float)( lineSize - numSamples - 2 );
+    delayStart = jlimit( 0.5f, maxDelay, delayStart );
+    delayEnd = jlimit( 0.5f, maxDelay, delayEnd );
+    const double delayStep = ( (double)delayEnd - delayStart ) / numSamples;
+    
+    float y = state;
+    for( int i = 0; i < numSamples; i++ )
+    {
+        double delay = delayStart + ( i + 1 ) * delayStep;
+        int delayInt = (int)( delay - 0.5 );
+        float frac = (float)( delay - delayInt );
+        float a = ( 1.f - frac ) / ( 1.f + frac );
+        
+        int index = writeIndex + i - delayInt;
+        if( index < 0 ){ index += lineSize; } else if( index >= lineSize ){ index -= lineSize; }
+        int indexPrev = index == 0 ? lineSize - 1 : index - 1;
+        
+        y = a * ( line[index] - y ) + line[indexPrev];
+        destination[i] = gain * y;
+    }
+    state = y;
 }
 
-// get interpolated delayed buffer out of delay line (linear interpolation between previous and next)
-void fillBufferWithDelayedChunk( AudioBuffer<float> & destination, const unsigned int destChannel, const unsigned int destStartSample, const unsigned int sourceChannel, const float delayInSamples, const float numSamples )
+// Thiran (1st order allpass) multi-tap read: y[n] = a x[n] + x[n-1] - a y[n-1], where x is the delay line read at
+// integer delay delayInt and a = (1 - frac) / (1 + frac) for a fractional part frac kept in [0.5, 1.5[
+void readAllpassTaps( float* destination, const unsigned int sourceChannel, const float* delaysInSamples, const float* gains, const int numTaps, const int numSamples, float* allpassStates ) const
 {
-    // get previous and next positions in delay line
-    _fillBufferWithDelayedChunk(chunkBufferPrev, 0, 0, sourceChannel, ceil(delayInSamples), numSamples);
-    _fillBufferWithDelayedChunk(chunkBufferNext, 0, 0, sourceChannel, floor(delayInSamples), numSamples);
+    const int lineSize = length;
+    const float* line = buffer->getReadPointer( sourceChannel );
     
-    // apply linear interpolation gains
-    float gainPrev = (float)(delayInSamples-floor(delayInSamples));
-    chunkBufferPrev.applyGain( gainPrev );
-    chunkBufferNext.applyGain( 1.f - gainPrev );
+    for( int t = 0; t < numTaps; t++ )
+    {
+        float delay = jlimit( 0.5f, (float)( lineSize - 2 ), delaysInSamples[t] );
+        int delayInt = (int)( delay - 0.5f );
+        float frac = delay - delayInt;
+        float a = ( 1.f - frac ) / ( 1.f + frac );
+        
+        int index = writeIndex - delayInt;
+        if( index < 0 ){ index += lineSize; }
+        int indexPrev = index == 0 ? lineSize - 1 : index - 1;
+        
+        int sampleId = 0;
+        while( sampleId < numSamples )
+        {
+            int segmentLength = jmin( numSamples - sampleId, lineSize - index, lineSize - indexPrev );
+            allpassSegment( destination + sampleId, line + index, line + indexPrev, a, gains[t], allpassStates[t], segmentLength, t > 0 );
+            
+            index += segmentLength; if( index == lineSize ){ index = 0; }
+            indexPrev += segmentLength; if( indexPrev == lineSize ){ indexPrev = 0; }
+            sampleId += segmentLength;
+        }
+    }
     
-    // sum buffer in output
-    destination.copyFrom(destChannel, destStartSample, chunkBufferPrev, 0, 0, numSamples);
-    destination.addFrom(destChannel, destStartSample, chunkBufferNext, 0, 0, numSamples);
+    if( numTaps == 0 ){ FloatVectorOperations::clear( destination, numSamples ); }
 }
 
+// allpass filtering of a contiguous segment, output scaled by gain written (or added) to destination
+static void allpassSegment( float* destination, const float* x, const float* xPrev, const float a, const float gain, float & state, const int numSamples, const bool add )
+{
+    int i = 0;
+    float y = state;
+
+#if SIMD_FLOAT4
+    // 4 samples at once: with u = a x[n] + x[n-1] and b = -a, y[n+k] = sum_{i<=k} b^(k-i) u[n+i] + b^(k+1) y[n-1],
+    // the sum is computed as a prefix scan (shifted adds with b and b^2)
+    const float b = -a;
+    const float4 a4 = set4( a ), b4 = set4( b ), bb4 = set4( b * b ), gain4 = set4( gain );
+    const float4 statePowers4 = setr4( b, b * b, b * b * b, b * b * b * b );
+    for( ; i + 4 <= numSamples; i += 4 )
+    {
+        float4 u = madd4( a4, load4( x + i ), load4( xPrev + i ) );
+        u = madd4( b4, shiftUp4<1>( u ), u );
+        u = madd4( bb4, shiftUp4<2>( u ), u );
+        float4 y4 = madd4( statePowers4, set4( y ), u );
+        y = lastLane4( y4 );
+        
+        float4 out = mul4( gain4, y4 );
+        if( add ){ out = add4( out, load4( destination + i ) ); }
+        store4( destination + i, out );
+    }
+#endif
+    
+    for( ; i < numSamples; i++ )
+    {
+        y = a * ( x[i] - y ) + xPrev[i];
+        destination[i] = add ? destination[i] + gain * y : gain * y;
+    }
+    
+    state = y;
+}
+
+// tabulate windowed-sinc (Blackman window) kernels for fractional delays phase / sincNumPhases, normalised to unit DC gain
+void initSincTable()
+{
+    sincTable.resize( ( sincNumPhases + 1 ) * sincKernelSize );
+    const double halfLength = sincKernelSize / 2;
+    for( int phase = 0; phase <= sincNumPhases; phase++ )
+    {
+        float* kernel = sincTable.data() + phase * sincKernelSize;
+        double sum = 0.0;
+        for( int k = 0; k < sincKernelSize; k++ )
+        {
+            // distance between point k and the fractional delay
+            double x = k - ( halfLength - 1 ) - (double)phase / sincNumPhases;
+            double sinc = ( x == 0.0 ) ? 1.0 : std::sin( M_PI * x ) / ( M_PI * x );
+            double window = 0.42 + 0.5 * std::cos( M_PI * x / halfLength ) + 0.08 * std::cos( 2.0 * M_PI * x / halfLength );
+            kernel[k] = (float)( sinc * window );
+            sum += kernel[k];
+        }
+        for( int k = 0; k < sincKernelSize; k++ ){ kernel[k] /= sum; }
+    }
+}
+
+public:
+
 // remove all content from delay line main buffer
 void clear()
 {
-    buffer.clear();
+    buffer->clear();
 }
 
 JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DelayLine)
@@ -0,0 +1,31 @@
+#include "FFTBackend.h"
+
+
+FFTBackend::Type FFTBackend::defaultType = FFTBackend::Type::Simd;
+
+void FFTBackend::init(size_t nfft, Type type)
+{
+	// SimdFFT needs at least 4 butterflies per stage
+	type_ = (nfft >= 16) ? type : Type::Ooura;
+
+	if (type_ == Type::Simd)
+		simdFFT_.init(nfft);
+	else
+		oouraFFT_.init(nfft);
+}
+
+void FFTBackend::fft(float* in, std::complex<float>* out)
+{
+	if (type_ == Type::Simd)
+		simdFFT_.fft(in, out);
+	else
+		oouraFFT_.fft(in, out);
+}
+
+void FFTBackend::ifft(std::complex<float>* in, float* out)
+{
+	if (type_ == Type::Simd)
+		simdFFT_.ifft(in, out);
+	else
+		oouraFFT_.ifft(in, out);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <complex>
+#include "OouraFFT.h"
+#include "SimdFFT.h"
+
+/**
+* Real FFT used by the convolution engines, implementation chosen at init: single precision
+* SimdFFT by default, double precision OouraFFT kept as reference (and for tiny transforms).
+* Both share the same spectrum format and scaling (ifft(fft(x)) = nfft/2 * x).
+* Held by value (no allocation, copyable), the dispatch costs one branch per transform.
+*/
+class FFTBackend
+{
+public:
+	enum class Type { Simd, Ooura };
+
+	// prepare for fft/ifft
+	// nfft - size of the future transforms
+	void init(size_t nfft, Type type = defaultType);
+
+	// in must have length nfft
+	// out must have length nfft/2 + 1
+	void fft(float* in, std::complex<float>* out);
+
+	// out must have length nfft
+	// in must have length nfft/2 + 1
+	void ifft(std::complex<float>* in, float* out);
+
+	Type getType() const { return type_; }
+
+	// implementation used by init when none is given (e.g. set to Ooura for reference renders / benchmarks)
+	static Type defaultType;
+
+private:
+	Type type_ = Type::Ooura;
+	OouraFFT oouraFFT_;
+	SimdFFT simdFFT_;
+};
@@ -4,7 +4,11 @@
 FIRFilter::FIRFilter()
 	:
 	irSize_(0),
-	bufferSize_(0)
+	bufferSize_(0),
+	nfft_(0),
+	numPartitions_(0),
+	fdlPos_(0),
+	initialized_(false)
 {
 }
 
@@ -21,19 +25,18 @@ void FIRFilter::init(size_t bufferSize, size_t irSize)
 	bufferSize_ = bufferSize;
 	initialized_ = true;
 
-	nfft_ = (size_t)nextPowerOf2((int)(irSize + bufferSize - 1));
-	oouraFFT.init(nfft_);
-	ir_.resize(nfft_);
-	H_.resize(nfft_ / 2 + 1);
-	tail_.resize(nfft_ - bufferSize);
+	// partitions of bufferSize samples, overlap-save requires nfft >= 2*bufferSize-1
+	numPartitions_ = (bufferSize > 0) ? (irSize + bufferSize - 1) / bufferSize : 0;
+	nfft_ = (bufferSize > 0) ? (size_t)nextPowerOf2((int)(2 * bufferSize - 1)) : 0;
+	fftBackend.init(nfft_);
 
-	timeBuffer_.resize(nfft_);
+	H_.assign(numPartitions_, ComplexVector<float>(nfft_ / 2 + 1));
+	fdl_.assign(numPartitions_, ComplexVector<float>(nfft_ / 2 + 1));
 	freqBuffer_.resize(nfft_ / 2 + 1);
+	inputBuffer_.resize(nfft_);
+	timeBuffer_.resize(nfft_);
 
-    /// DPQ
-    // zero-out tail buffer
-    memset(tail_.data(), 0, tail_.size() * sizeof(float));
-    currentReadPos_ = 0;
+	reset();
 }
 
 void FIRFilter::setImpulseResponse(const float* ir)
@@ -42,11 +45,18 @@ void FIRFilter::setImpulseResponse(const float* ir)
 	if (nfft_ == 0)
 		return;
 
-	// zero-padded impulse response
-	memcpy(ir_.data(), ir, irSize_ * sizeof(float));
-
-	// compute transfer function
-	oouraFFT.fft(ir_.data(), H_.data());
+	// transfer function of each zero-padded partition, ifft normalization folded in
+	auto scale = 2.f / nfft_;
+	for (size_t p = 0; p < numPartitions_; ++p)
+	{
+		size_t partitionSize = std::min(bufferSize_, irSize_ - p * bufferSize_);
+		memset(timeBuffer_.data(), 0, timeBuffer_.size() * sizeof(float));
+		memcpy(timeBuffer_.data(), ir + p * bufferSize_, partitionSize * sizeof(float));
+		fftBackend.fft(timeBuffer_.data(), H_[p].data());
+
+		for (auto i = 0u; i < nfft_ / 2 + 1; ++i)
+			H_[p][i] *= scale;
+	}
 }
 
 void FIRFilter::process(float* in)
@@ -55,61 +65,29 @@ void FIRFilter::process(float* in)
 	if (nfft_ == 0 || bufferSize_ == 0 || irSize_ == 0)
 		return;
 
-	// zero-out time buffer
-	memset(timeBuffer_.data(), 0, timeBuffer_.size() * sizeof(float));
-	// fft of zero padded input
-	memcpy(timeBuffer_.data(), in, bufferSize_ * sizeof(float));
-	oouraFFT.fft(timeBuffer_.data(), freqBuffer_.data());
+	// slide input window, fft of the last nfft input samples into the delay line
+	memmove(inputBuffer_.data(), inputBuffer_.data() + bufferSize_, (nfft_ - bufferSize_) * sizeof(float));
+	memcpy(inputBuffer_.data() + nfft_ - bufferSize_, in, bufferSize_ * sizeof(float));
+	fdlPos_ = (fdlPos_ + 1) % numPartitions_;
+	fftBackend.fft(inputBuffer_.data(), fdl_[fdlPos_].data());
 
-	// multiply and normalize
-	auto scale = 2.f / nfft_;
-	for (auto i = 0u; i < nfft_ / 2 + 1; ++i)
-		freqBuffer_[i] = scale * freqBuffer_[i] * H_[i];
+	// multiply-accumulate: partition p filters the input block received p calls ago
+	size_t numBins = nfft_ / 2 + 1;
+	std::fill(freqBuffer_.begin(), freqBuffer_.begin() + numBins, std::complex<float>(0.f, 0.f));
+	for (size_t p = 0; p < numPartitions_; ++p)
+		complexMultiplyAccumulate(freqBuffer_.data(), fdl_[(fdlPos_ + numPartitions_ - p) % numPartitions_].data(), H_[p].data(), numBins);
 
-	// ifft of the product
-	oouraFFT.ifft(freqBuffer_.data(), timeBuffer_.data());
+	// ifft of the sum, last bufferSize samples are free of circular aliasing
+	fftBackend.ifft(freqBuffer_.data(), timeBuffer_.data());
 
 	// copy to output
-	memcpy(in, timeBuffer_.data(), bufferSize_ * sizeof(float));
-
-	// tail
-//	for (size_t i = 0; i < tail_.size(); ++i)
-//	{
-//		in[i] += tail_[i]; // add to output
-//		tail_[i] = timeBuffer_[i + bufferSize_]; // buffer
-//    
-//    }
-
-    ////////////////////////////////////////////////////////////////// DPQ
-    // tail
-    int tmpReadPos = currentReadPos_;
-    
-    for (size_t i = 0; i < timeBuffer_.size(); ++i)
-    {
-        if (i < bufferSize_)
-        {
-            in[i] += tail_[tmpReadPos]; // add tail to output
-            tail_[tmpReadPos] = 0.0;    // empty what's been used
-        }
-        else
-        {
-            tail_[tmpReadPos] += timeBuffer_[i]; // buffer in tail
-        }
-        if (++tmpReadPos >= tail_.size()){
-            tmpReadPos = 0;
-        }
-    }
-
-    currentReadPos_ = currentReadPos_ + bufferSize_;
-    if (currentReadPos_ >= tail_.size()) // modulo
-    {
-        currentReadPos_ = currentReadPos_ - tail_.size();
-    }
-    
-    //////////////////////////////////////////////////////////////////
+	memcpy(in, timeBuffer_.data() + nfft_ - bufferSize_, bufferSize_ * sizeof(float));
 }
 
 void FIRFilter::reset()
 {
-	memset(tail_.data(), 0, tail_.size() * sizeof(float));
+	memset(inputBuffer_.data(), 0, inputBuffer_.size() * sizeof(float));
+	for (auto& X : fdl_)
+		std::fill(X.begin(), X.end(), std::complex<float>(0.f, 0.f));
+	fdlPos_ = 0;
 }
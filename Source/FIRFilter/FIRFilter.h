@@ -1,12 +1,17 @@
 #pragma once
 #include <complex>
 #include <vector>
-#include "OouraFFT.h"
+#include "FFTBackend.h"
 #include "../Utils.h"
 #include "../JuceLibraryCode/JuceHeader.h" // to use DBG
 
 /**
 * Class for fast (FFT based) finite-impulse-response (mono) filtering.
+*
+* Uniformly partitioned overlap-save convolution: the impulse response is split in partitions
+* of bufferSize samples, each convolved in the frequency domain with the spectrum of the matching
+* past input block (frequency-domain delay line). One forward and one inverse FFT of size
+* ~2*bufferSize per call whatever the IR length, no added latency.
 */
 class FIRFilter
 {
@@ -41,18 +46,18 @@ public:
 	void reset();
 
 private:
-	OouraFFT oouraFFT;
+	FFTBackend fftBackend;
 
-	ComplexVector<float> H_; // transfer function
-	ComplexVector<float> freqBuffer_; // input's dft buffer
-	std::vector<float> ir_; // impulse response
-	std::vector<float> tail_; // processing tail (buffer for the next block)
-	std::vector<float> timeBuffer_; // buffer of the input samples
+	std::vector<ComplexVector<float>> H_; // transfer function, one spectrum per IR partition (normalized)
+	std::vector<ComplexVector<float>> fdl_; // frequency-domain delay line: spectra of the last input blocks
+	ComplexVector<float> freqBuffer_; // accumulated output spectrum
+	std::vector<float> inputBuffer_; // sliding window over the last nfft input samples
+	std::vector<float> timeBuffer_; // fft / ifft buffer
 
 	size_t irSize_;
 	size_t bufferSize_;
 	size_t nfft_;
+	size_t numPartitions_;
+	size_t fdlPos_; // index of the most recent input spectrum in fdl_
 	bool initialized_;
-
-    int currentReadPos_;
 };
@@ -27,7 +27,9 @@ void OouraFFT::fft(float* in, std::complex<float>* out)
 		out[i].real((float)buffer_[i * 2]); //real part
 		out[i].imag((float)buffer_[i * 2 + 1]); // imag part
 	}
+	out[0].imag(0.f); // a[1] holds R[n/2], not I[0]
 	out[nfft / 2].real((float)buffer_[1]); // a[1] = R[n/2]
+	out[nfft / 2].imag(0.f);
 }
 
 void OouraFFT::ifft(std::complex<float>* in, float* out)
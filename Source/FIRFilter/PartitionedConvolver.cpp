@@ -0,0 +1,205 @@
+#include "PartitionedConvolver.h"
+
+
+PartitionedConvolver::SegmentThread::SegmentThread(Segment& segment)
+	:
+	Thread("EvertSE convolver " + String((int)segment.partitionSize)),
+	segment_(segment)
+{
+}
+
+void PartitionedConvolver::SegmentThread::run()
+{
+	while (!threadShouldExit())
+	{
+		// woken up by the audio thread once a new input block is available
+		wait(-1);
+		if (threadShouldExit() || !segment_.busy.load())
+			continue;
+
+		for (size_t c = 0; c < segment_.filters.size(); ++c)
+		{
+			memcpy(segment_.outputPending[c].data(), segment_.inputPending.data(), segment_.partitionSize * sizeof(float));
+			segment_.filters[c].process(segment_.outputPending[c].data());
+		}
+		segment_.busy.store(false);
+	}
+}
+
+PartitionedConvolver::PartitionedConvolver()
+	:
+	irSize_(0),
+	bufferSize_(0),
+	numChannels_(0),
+	initialized_(false)
+{
+}
+
+PartitionedConvolver::~PartitionedConvolver()
+{
+	for (auto& segment : segments_)
+		segment->thread->stopThread(1000);
+}
+
+void PartitionedConvolver::init(size_t bufferSize, size_t irSize, size_t numChannels)
+{
+	assert(bufferSize > 0);
+
+	// stop previous segment threads
+	for (auto& segment : segments_)
+		segment->thread->stopThread(1000);
+	segments_.clear();
+
+	irSize_ = irSize;
+	bufferSize_ = bufferSize;
+	numChannels_ = numChannels;
+	initialized_ = true;
+
+	// head: partitions of bufferSize samples, up to the start of the first segment
+	size_t partitionSize = bufferSize * partitionSizeRatio;
+	size_t irStart = std::min(irSize, 2 * partitionSize);
+	head_.assign(numChannels, FIRFilter());
+	for (auto& filter : head_)
+		filter.init(bufferSize, irStart);
+
+	// segments: partition size L covers [2L, 2L*partitionSizeRatio[ (or up to the end of the impulse response)
+	while (irStart < irSize)
+	{
+		size_t nextPartitionSize = partitionSize * partitionSizeRatio;
+		size_t irEnd = (nextPartitionSize <= maxPartitionSize) ? std::min(irSize, 2 * nextPartitionSize) : irSize;
+
+		std::unique_ptr<Segment> segment(new Segment());
+		segment->partitionSize = partitionSize;
+		segment->irStart = irStart;
+		segment->irEnd = irEnd;
+		segment->filters.assign(numChannels, FIRFilter());
+		for (auto& filter : segment->filters)
+			filter.init(partitionSize, irEnd - irStart);
+		segment->input.assign(partitionSize, 0.f);
+		segment->inputPending.assign(partitionSize, 0.f);
+		segment->output.assign(numChannels, std::vector<float>(partitionSize, 0.f));
+		segment->outputPending.assign(numChannels, std::vector<float>(partitionSize, 0.f));
+		segment->writePos = 0;
+		segment->busy.store(false);
+		segment->late = false;
+		segment->numLateBlocks.store(0);
+		segment->thread.reset(new SegmentThread(*segment));
+
+		// shorter partitions have tighter deadlines: higher priority (high, below audio thread)
+		segment->thread->startThread(jmax(6, 9 - (int)segments_.size()));
+		segments_.push_back(std::move(segment));
+
+		irStart = irEnd;
+		partitionSize = nextPartitionSize;
+	}
+}
+
+void PartitionedConvolver::setImpulseResponse(size_t channel, const float* ir)
+{
+	assert(initialized_);
+	assert(channel < numChannels_);
+
+	head_[channel].setImpulseResponse(ir);
+	for (auto& segment : segments_)
+	{
+		waitForSegment(*segment);
+		segment->filters[channel].setImpulseResponse(ir + segment->irStart);
+	}
+}
+
+void PartitionedConvolver::process(const float* in, float* const* out)
+{
+	assert(initialized_);
+
+	// feed segments input (before head processing, in case out[0] == in)
+	for (auto& segment : segments_)
+		memcpy(segment->input.data() + segment->writePos, in, bufferSize_ * sizeof(float));
+
+	// head, computed in place in output
+	for (size_t c = 0; c < numChannels_; ++c)
+	{
+		if (out[c] != in)
+			memcpy(out[c], in, bufferSize_ * sizeof(float));
+		head_[c].process(out[c]);
+	}
+
+	// add segments output, hand complete input blocks to their threads
+	for (auto& segment : segments_)
+	{
+		for (size_t c = 0; c < numChannels_; ++c)
+			FloatVectorOperations::add(out[c], segment->output[c].data() + segment->writePos, (int)bufferSize_);
+
+		segment->writePos += bufferSize_;
+		if (segment->writePos == segment->partitionSize)
+		{
+			// previous block is due now: only waits (a bounded time) if the background thread fell behind
+			segment->writePos = 0;
+			if (!waitForSegment(*segment, maxWaitDuration))
+			{
+				// late: play silence, drop this input block (the thread still reads the previous one)
+				for (auto& output : segment->output)
+					std::fill(output.begin(), output.end(), 0.f);
+				segment->late = true;
+				segment->numLateBlocks.fetch_add(1);
+				continue;
+			}
+
+			// output computed after a late block is out of date: play silence instead
+			if (segment->late)
+			{
+				for (auto& output : segment->outputPending)
+					std::fill(output.begin(), output.end(), 0.f);
+				segment->late = false;
+			}
+			std::swap(segment->output, segment->outputPending);
+			std::swap(segment->input, segment->inputPending);
+			segment->busy.store(true);
+			segment->thread->notify();
+		}
+	}
+}
+
+void PartitionedConvolver::process(float* in)
+{
+	assert(numChannels_ == 1);
+	float* out[1] = { in };
+	process(in, out);
+}
+
+void PartitionedConvolver::reset()
+{
+	for (auto& filter : head_)
+		filter.reset();
+
+	for (auto& segment : segments_)
+	{
+		waitForSegment(*segment);
+		for (auto& filter : segment->filters)
+			filter.reset();
+		for (auto& output : segment->output)
+			std::fill(output.begin(), output.end(), 0.f);
+		std::fill(segment->input.begin(), segment->input.end(), 0.f);
+		segment->writePos = 0;
+		segment->late = false;
+	}
+}
+
+size_t PartitionedConvolver::getNumLateBlocks() const
+{
+	size_t numLateBlocks = 0;
+	for (auto& segment : segments_)
+		numLateBlocks += segment->numLateBlocks.load();
+	return numLateBlocks;
+}
+
+bool PartitionedConvolver::waitForSegment(Segment& segment, double timeout)
+{
+	int64 startTicks = Time::getHighResolutionTicks();
+	while (segment.busy.load())
+	{
+		if (timeout >= 0.0 && Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks) > timeout)
+			return false;
+		Thread::yield();
+	}
+	return true;
+}
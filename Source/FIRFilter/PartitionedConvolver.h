@@ -0,0 +1,105 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "FIRFilter.h"
+#include "../JuceLibraryCode/JuceHeader.h" // to use Thread
+
+/**
+* Class for zero-latency convolution with long impulse responses, from one input to one or more
+* outputs (e.g. mono source to the Ambisonic channels of a measured room impulse response).
+*
+* Non-uniformly partitioned: the head of the impulse response is convolved on the calling (audio)
+* thread with partitions of bufferSize samples, the rest is split in segments convolved with
+* partitions growing by partitionSizeRatio, each segment on its own background thread. A segment
+* of partition size L starts 2*L samples into the impulse response, which leaves its thread the
+* duration of one partition to compute each of its output blocks. A segment block not ready in time
+* (after waiting at most maxWaitDuration) is played as silence instead of stalling the audio thread.
+*/
+class PartitionedConvolver
+{
+public:
+	PartitionedConvolver();
+	~PartitionedConvolver();
+
+	/**
+	* Prepares the convolver for processing (allocates, starts background threads).
+	* Must be called before the first call to process, not from the audio thread.
+	*
+	* @param bufferSize size of the input time data
+	* @param irSize size of the impulse responses
+	* @param numChannels number of output channels (one impulse response per channel)
+	*/
+	void init(size_t bufferSize, size_t irSize, size_t numChannels);
+
+	/**
+	* Sets the impulse response of a given output channel.
+	* It will copy 'irSize' samples from the given array. Not to be called concurrently with process.
+	*/
+	void setImpulseResponse(size_t channel, const float* ir);
+
+	/**
+	* Process given array of bufferSize samples, write the result of each channel to out[channel].
+	*/
+	void process(const float* in, float* const* out);
+
+	/**
+	* Process given array of samples, in-place (single channel convolver only).
+	*/
+	void process(float* in);
+
+	/**
+	* Resets the internal state of the convolver (removes tail from the previous processing blocks).
+	*/
+	void reset();
+
+	size_t getNumChannels() const { return numChannels_; }
+
+	/**
+	* Number of segment output blocks not computed in time (played as silence) since init.
+	*/
+	size_t getNumLateBlocks() const;
+
+	static const size_t partitionSizeRatio = 4; // partition size growth from one segment to the next
+	static const size_t maxPartitionSize = 16384; // last segment covers the end of the impulse response
+	static constexpr double maxWaitDuration = 0.0005; // in sec, max wait of the audio thread for a segment thread
+
+private:
+	// impulse response segment convolved on a background thread
+	struct Segment
+	{
+		size_t partitionSize;
+		size_t irStart;
+		size_t irEnd;
+		std::vector<FIRFilter> filters; // one per channel
+		std::vector<float> input; // input block being accumulated by the audio thread
+		std::vector<float> inputPending; // input block being convolved by the background thread
+		std::vector<std::vector<float>> output; // output block being played, one per channel
+		std::vector<std::vector<float>> outputPending; // output block being computed, one per channel
+		size_t writePos;
+		std::atomic<bool> busy;
+		bool late; // last input block not handed over (thread busy): output pending when done is out of date
+		std::atomic<size_t> numLateBlocks;
+		std::unique_ptr<Thread> thread;
+	};
+
+	class SegmentThread : public Thread
+	{
+	public:
+		SegmentThread(Segment& segment);
+		void run() override;
+	private:
+		Segment& segment_;
+	};
+
+	// wait for the segment thread to be done, at most timeout sec (no limit if negative), returns false if still busy
+	bool waitForSegment(Segment& segment, double timeout = -1.0);
+
+	std::vector<FIRFilter> head_; // head of the impulse responses, one filter per channel
+	std::vector<std::unique_ptr<Segment>> segments_;
+
+	size_t irSize_;
+	size_t bufferSize_;
+	size_t numChannels_;
+	bool initialized_;
+};
@@ -0,0 +1,248 @@
+#include "SimdFFT.h"
+
+#include "../SimdFloat4.h"
+
+
+void SimdFFT::init(size_t nfft)
+{
+	assert(isPowerOf2(nfft) && nfft >= 16);
+
+	nfft_ = nfft;
+	size_t M = nfft / 2;
+
+	twiddleRe_.resize(M);
+	twiddleIm_.resize(M);
+	for (size_t k = 0; k < M; ++k)
+	{
+		twiddleRe_[k] = (float)std::cos(2.0 * M_PI * k / M);
+		twiddleIm_[k] = (float)-std::sin(2.0 * M_PI * k / M);
+	}
+
+	// first radix-4 stage twiddles w^p, w^2p, w^3p, stored contiguously to be loaded as vectors
+	firstStageTwiddleRe_.resize(3 * (M / 4));
+	firstStageTwiddleIm_.resize(3 * (M / 4));
+	for (size_t k = 1; k <= 3; ++k)
+	{
+		for (size_t p = 0; p < M / 4; ++p)
+		{
+			firstStageTwiddleRe_[(k - 1) * (M / 4) + p] = twiddleRe_[k * p];
+			firstStageTwiddleIm_[(k - 1) * (M / 4) + p] = twiddleIm_[k * p];
+		}
+	}
+
+	realTwiddleRe_.resize(M);
+	realTwiddleIm_.resize(M);
+	for (size_t k = 0; k < M; ++k)
+	{
+		realTwiddleRe_[k] = (float)std::cos(2.0 * M_PI * k / nfft);
+		realTwiddleIm_[k] = (float)-std::sin(2.0 * M_PI * k / nfft);
+	}
+
+	re_.resize(M);
+	im_.resize(M);
+	workRe_.resize(M);
+	workIm_.resize(M);
+}
+
+void SimdFFT::complexFFT(float*& outRe, float*& outIm)
+{
+	size_t M = nfft_ / 2;
+	float* xr = re_.data();
+	float* xi = im_.data();
+	float* yr = workRe_.data();
+	float* yi = workIm_.data();
+	const float* wr = twiddleRe_.data();
+	const float* wi = twiddleIm_.data();
+
+	// radix-4 stages of length n, stride s (m = n/4, w = exp(-2i.pi/M)):
+	// with a_k = x[q + s*(p + k*m)], t0 = a0 + a2, t1 = a0 - a2, t2 = a1 + a3, t3 = -i (a1 - a3)
+	// y[q + s*4p] = t0 + t2, y[q + s*(4p+1)] = (t1 + t3) w^ps, y[q + s*(4p+2)] = (t0 - t2) w^2ps, y[q + s*(4p+3)] = (t1 - t3) w^3ps
+	size_t n = M, s = 1;
+	for (; n >= 4; n /= 4, s *= 4)
+	{
+		size_t m = n / 4;
+
+#if SIMD_FLOAT4
+		if (s >= 4)
+		{
+			// vectorized over q
+			for (size_t p = 0; p < m; ++p)
+			{
+				float4 w1r = set4(wr[p * s]), w1i = set4(wi[p * s]);
+				float4 w2r = set4(wr[2 * p * s]), w2i = set4(wi[2 * p * s]);
+				float4 w3r = set4(wr[3 * p * s]), w3i = set4(wi[3 * p * s]);
+				for (size_t q = 0; q < s; q += 4)
+				{
+					const float* x0r = xr + q + s * p;
+					const float* x0i = xi + q + s * p;
+					float4 a0r = load4(x0r), a0i = load4(x0i);
+					float4 a1r = load4(x0r + s * m), a1i = load4(x0i + s * m);
+					float4 a2r = load4(x0r + 2 * s * m), a2i = load4(x0i + 2 * s * m);
+					float4 a3r = load4(x0r + 3 * s * m), a3i = load4(x0i + 3 * s * m);
+					float4 t0r = add4(a0r, a2r), t0i = add4(a0i, a2i);
+					float4 t1r = sub4(a0r, a2r), t1i = sub4(a0i, a2i);
+					float4 t2r = add4(a1r, a3r), t2i = add4(a1i, a3i);
+					float4 t3r = sub4(a1i, a3i), t3i = sub4(a3r, a1r);
+					float4 ur = add4(t1r, t3r), ui = add4(t1i, t3i);
+					float4 vr = sub4(t0r, t2r), vi = sub4(t0i, t2i);
+					float4 zr = sub4(t1r, t3r), zi = sub4(t1i, t3i);
+					float* y0r = yr + q + s * 4 * p;
+					float* y0i = yi + q + s * 4 * p;
+					store4(y0r, add4(t0r, t2r));
+					store4(y0i, add4(t0i, t2i));
+					store4(y0r + s, sub4(mul4(ur, w1r), mul4(ui, w1i)));
+					store4(y0i + s, add4(mul4(ur, w1i), mul4(ui, w1r)));
+					store4(y0r + 2 * s, sub4(mul4(vr, w2r), mul4(vi, w2i)));
+					store4(y0i + 2 * s, add4(mul4(vr, w2i), mul4(vi, w2r)));
+					store4(y0r + 3 * s, sub4(mul4(zr, w3r), mul4(zi, w3i)));
+					store4(y0i + 3 * s, add4(mul4(zr, w3i), mul4(zi, w3r)));
+				}
+			}
+		}
+		else if (s == 1 && m >= 4)
+		{
+			// first stage, vectorized over p: outputs of 4 consecutive p transposed before store
+			const float* f1r = firstStageTwiddleRe_.data();
+			const float* f1i = firstStageTwiddleIm_.data();
+			for (size_t p = 0; p < m; p += 4)
+			{
+				float4 a0r = load4(xr + p), a0i = load4(xi + p);
+				float4 a1r = load4(xr + p + m), a1i = load4(xi + p + m);
+				float4 a2r = load4(xr + p + 2 * m), a2i = load4(xi + p + 2 * m);
+				float4 a3r = load4(xr + p + 3 * m), a3i = load4(xi + p + 3 * m);
+				float4 w1r = load4(f1r + p), w1i = load4(f1i + p);
+				float4 w2r = load4(f1r + m + p), w2i = load4(f1i + m + p);
+				float4 w3r = load4(f1r + 2 * m + p), w3i = load4(f1i + 2 * m + p);
+				float4 t0r = add4(a0r, a2r), t0i = add4(a0i, a2i);
+				float4 t1r = sub4(a0r, a2r), t1i = sub4(a0i, a2i);
+				float4 t2r = add4(a1r, a3r), t2i = add4(a1i, a3i);
+				float4 t3r = sub4(a1i, a3i), t3i = sub4(a3r, a1r);
+				float4 ur = add4(t1r, t3r), ui = add4(t1i, t3i);
+				float4 vr = sub4(t0r, t2r), vi = sub4(t0i, t2i);
+				float4 zr = sub4(t1r, t3r), zi = sub4(t1i, t3i);
+				store4Transposed(yr + 4 * p, add4(t0r, t2r), sub4(mul4(ur, w1r), mul4(ui, w1i)), sub4(mul4(vr, w2r), mul4(vi, w2i)), sub4(mul4(zr, w3r), mul4(zi, w3i)));
+				store4Transposed(yi + 4 * p, add4(t0i, t2i), add4(mul4(ur, w1i), mul4(ui, w1r)), add4(mul4(vr, w2i), mul4(vi, w2r)), add4(mul4(zr, w3i), mul4(zi, w3r)));
+			}
+		}
+		else
+#endif
+		{
+			for (size_t p = 0; p < m; ++p)
+			{
+				float w1r = wr[p * s], w1i = wi[p * s];
+				float w2r = wr[2 * p * s], w2i = wi[2 * p * s];
+				float w3r = wr[3 * p * s], w3i = wi[3 * p * s];
+				for (size_t q = 0; q < s; ++q)
+				{
+					size_t i0 = q + s * p;
+					float a0r = xr[i0], a0i = xi[i0];
+					float a1r = xr[i0 + s * m], a1i = xi[i0 + s * m];
+					float a2r = xr[i0 + 2 * s * m], a2i = xi[i0 + 2 * s * m];
+					float a3r = xr[i0 + 3 * s * m], a3i = xi[i0 + 3 * s * m];
+					float t0r = a0r + a2r, t0i = a0i + a2i;
+					float t1r = a0r - a2r, t1i = a0i - a2i;
+					float t2r = a1r + a3r, t2i = a1i + a3i;
+					float t3r = a1i - a3i, t3i = a3r - a1r;
+					float ur = t1r + t3r, ui = t1i + t3i;
+					float vr = t0r - t2r, vi = t0i - t2i;
+					float zr = t1r - t3r, zi = t1i - t3i;
+					size_t o0 = q + s * 4 * p;
+					yr[o0] = t0r + t2r;
+					yi[o0] = t0i + t2i;
+					yr[o0 + s] = ur * w1r - ui * w1i;
+					yi[o0 + s] = ur * w1i + ui * w1r;
+					yr[o0 + 2 * s] = vr * w2r - vi * w2i;
+					yi[o0 + 2 * s] = vr * w2i + vi * w2r;
+					yr[o0 + 3 * s] = zr * w3r - zi * w3i;
+					yi[o0 + 3 * s] = zr * w3i + zi * w3r;
+				}
+			}
+		}
+
+		std::swap(xr, yr);
+		std::swap(xi, yi);
+	}
+
+	// last radix-2 stage if M is an odd power of 2 (n = 2, twiddle = 1, s = M/2)
+	if (n == 2)
+	{
+		for (size_t q = 0; q < s; ++q)
+		{
+			float ar = xr[q], ai = xi[q];
+			float br = xr[q + s], bi = xi[q + s];
+			yr[q] = ar + br;
+			yi[q] = ai + bi;
+			yr[q + s] = ar - br;
+			yi[q + s] = ai - bi;
+		}
+		std::swap(xr, yr);
+		std::swap(xi, yi);
+	}
+
+	outRe = xr;
+	outIm = xi;
+}
+
+void SimdFFT::fft(float* in, std::complex<float>* out)
+{
+	size_t M = nfft_ / 2;
+
+	// pack even / odd samples as real / imaginary parts of a half size complex sequence
+	for (size_t n = 0; n < M; ++n)
+	{
+		re_[n] = in[2 * n];
+		im_[n] = in[2 * n + 1];
+	}
+
+	float* zr;
+	float* zi;
+	complexFFT(zr, zi);
+
+	// split even / odd spectra: X[k] = Xe[k] + w^k Xo[k], Xe = (Z[k] + Z*[M-k]) / 2, Xo = -i (Z[k] - Z*[M-k]) / 2
+	// (conjugated on output to match OouraFFT sign convention)
+	out[0] = std::complex<float>(zr[0] + zi[0], 0.f);
+	out[M] = std::complex<float>(zr[0] - zi[0], 0.f);
+	for (size_t k = 1; k < M; ++k)
+	{
+		float er = 0.5f * (zr[k] + zr[M - k]);
+		float ei = 0.5f * (zi[k] - zi[M - k]);
+		float or_ = 0.5f * (zi[k] + zi[M - k]);
+		float oi = -0.5f * (zr[k] - zr[M - k]);
+		float wr = realTwiddleRe_[k], wi = realTwiddleIm_[k];
+		out[k] = std::complex<float>(er + or_ * wr - oi * wi, -(ei + or_ * wi + oi * wr));
+	}
+}
+
+void SimdFFT::ifft(std::complex<float>* in, float* out)
+{
+	size_t M = nfft_ / 2;
+
+	// merge even / odd spectra (X = conj(in), imaginary parts of DC and Nyquist bins ignored):
+	// Z[k] = Xe[k] + i Xo[k], Xe = (X[k] + X*[M-k]) / 2, Xo = (X[k] - X*[M-k]) / 2 * conj(w^k).
+	// Inverse FFT computed as conj(FFT(conj(Z))), hence conj(Z) packed.
+	float dc = in[0].real(), nyquist = in[M].real();
+	re_[0] = 0.5f * (dc + nyquist);
+	im_[0] = -0.5f * (dc - nyquist);
+	for (size_t k = 1; k < M; ++k)
+	{
+		float xr = in[k].real(), xi = -in[k].imag();
+		float yr = in[M - k].real(), yi = in[M - k].imag(); // conj(X[M-k])
+		float er = 0.5f * (xr + yr), ei = 0.5f * (xi + yi);
+		float dr = 0.5f * (xr - yr), di = 0.5f * (xi - yi);
+		float wr = realTwiddleRe_[k], wi = -realTwiddleIm_[k];
+		float or_ = dr * wr - di * wi, oi = dr * wi + di * wr;
+		re_[k] = er - oi;
+		im_[k] = -(ei + or_);
+	}
+
+	float* zr;
+	float* zi;
+	complexFFT(zr, zi);
+
+	// unpack (scaled by nfft/2, as OouraFFT)
+	for (size_t n = 0; n < M; ++n)
+	{
+		out[2 * n] = zr[n];
+		out[2 * n + 1] = -zi[n];
+	}
+}
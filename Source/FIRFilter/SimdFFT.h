@@ -0,0 +1,37 @@
+#pragma once
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include "../Utils.h"
+
+/**
+* Single precision real FFT, same input / output format and scaling as OouraFFT (no conversion
+* to double). Radix-4 Stockham (self-sorting) complex FFT of size nfft/2 on split real / imaginary
+* arrays, vectorized with SSE or NEON when available (scalar loops otherwise).
+*/
+class SimdFFT
+{
+public:
+	// prepare for fft/ifft
+	// nfft - size of the future transforms (power of 2, at least 16)
+	void init(size_t nfft);
+
+	// in must have length nfft
+	// out must have length nfft/2 + 1
+	void fft(float* in, std::complex<float>* out);
+
+	// out must have length nfft
+	// in must have length nfft/2 + 1
+	void ifft(std::complex<float>* in, float* out);
+
+private:
+	// forward complex FFT of size nfft/2 of re_ / im_, returns pointers to the result (re_ / im_ or work buffers)
+	void complexFFT(float*& outRe, float*& outIm);
+
+	size_t nfft_ = 0;
+	std::vector<float> twiddleRe_, twiddleIm_; // exp(-2i.pi.k/(nfft/2)), k < nfft/2
+	std::vector<float> firstStageTwiddleRe_, firstStageTwiddleIm_; // [w^p, w^2p, w^3p], p < nfft/8
+	std::vector<float> realTwiddleRe_, realTwiddleIm_; // exp(-2i.pi.k/nfft), k < nfft/2
+	std::vector<float> re_, im_, workRe_, workIm_; // split complex buffers, nfft/2 each
+};
@@ -1,6 +1,8 @@
 #ifndef FILTERBANK_H_INCLUDED
 #define FILTERBANK_H_INCLUDED
 
+#include "SimdFloat4.h"
+
 class FilterBank
 {
 
@@ -10,22 +12,44 @@ class FilterBank
 public:
 
     int numOctaveBands = 0;
-    int numIndptStream = 0;
+    
+    // number of source signals decomposed at once by decomposeBuffers (one per SIMD lane)
+    static const int numLanes = 4;
+    
+    // NOTE: a filter is stateful, and needs to be given a continuous stream of audio. Hence, each source
+    // image needs its own separate filter state (see e.g. https://forum.juce.com/t/iirfilter-help/1733/7 ),
+    // kept by the caller. Coefficients only depend on the number of bands and are shared by all states.
+    struct FilterState
+    {
+        // transposed direct form II state of each lowpass filter (same as JUCE IIRFilter)
+        std::array<float, NUM_OCTAVE_BANDS-1> v1 {{}};
+        std::array<float, NUM_OCTAVE_BANDS-1> v2 {{}};
+        
+        void reset()
+        {
+            v1.fill( 0.f );
+            v2.fill( 0.f );
+        }
+        
+        // true if filters are at rest (output is zero for zero input)
+        bool isCleared() const
+        {
+            for( int i = 0; i < NUM_OCTAVE_BANDS-1; i++ ){ if( v1[i] != 0.f || v2[i] != 0.f ){ return false; } }
+            return true;
+        }
+    };
 
 private:
-
-    double localSampleRate;
-    int localSamplesPerBlockExpected;
-
-    int _numOctaveBands = 0;
-    int _numIndptStream = 0;
-    bool updateRequired = false;
     
-    std::vector<std::array<IIRFilter, NUM_OCTAVE_BANDS-1> > octaveFilterBanks;
-        
-    AudioBuffer<float> bufferFiltered;
-    AudioBuffer<float> bufferRemains;
+    double localSampleRate = 0.0;
+    int localSamplesPerBlockExpected;
     
+    // lowpass filters of the 3 and 10 band designs (see getCrossoverFrequency), computed once per sampling rate
+    // and shared by all filter states: changing the number of bands only selects a design
+    std::array<IIRCoefficients, 2> coefficients3Bands;
+    std::array<IIRCoefficients, NUM_OCTAVE_BANDS-1> coefficients10Bands;
+    const IIRCoefficients* coefficients = coefficients10Bands.data(); // design in use
+
 //==========================================================================
 // METHODS
     
@@ -38,100 +62,178 @@ FilterBank() {}
 // local equivalent of prepareToPlay
 void prepareToPlay( const unsigned int samplesPerBlockExpected, const double sampleRate )
 {
-    localSampleRate = sampleRate;
+    // cut-off frequencies depend on sampling rate
+    if( sampleRate != localSampleRate )
+    {
+        localSampleRate = sampleRate;
+        designFilters();
+    }
     localSamplesPerBlockExpected = samplesPerBlockExpected;
-    bufferFiltered.setSize(1, samplesPerBlockExpected);
-    bufferRemains = bufferFiltered;
 }
 
-void setNumFilters( const unsigned int numBands, const unsigned int numSourceImages )
-{   
-    // skip if nothing has changed
-    if( numOctaveBands == numBands && numIndptStream == numSourceImages ){ return; }
-    
-    // update future values
+// Define number of frequency bands in filter-bank (only choice is betwen 3 or 10). Filter states
+// used so far no longer match the new filters and should be reset.
+void setNumBands( const unsigned int numBands )
+{
     numOctaveBands = numBands;
-    numIndptStream = numSourceImages;
-    
-    // flag update required
-    updateRequired = true;
+    coefficients = ( numBands == 10 ) ? coefficients10Bands.data() : coefficients3Bands.data();
 }
+
+// cut-off frequency of lowpass filter i of the 3 or 10 band design, in Hz. 10 bands: octave bands from 31.5 Hz,
+// cut-off halfway between band center and next one (between last center and 20 kHz for the last filter), as in
+// Utils/evertims_filterbank/filterBankDesign2.m. 3 bands: cut-offs of the 10 band design where from10to3bands
+// splits its bands (low: 31.5 to 500 Hz, mid: 1 to 8 kHz, high: 16 kHz)
+static double getCrossoverFrequency( const int numBands, const int i )
+{
+    if( numBands != 10 ){ return getCrossoverFrequency( 10, ( i == 0 ) ? 4 : 8 ); }
     
-// Define number of frequency bands in filter-bank (only choice is betwen 3 or 10)
-// NOTE: a filter is stateful, and needs to be given a continuous stream of audio. Hence, each source
-// image needs its own separate filter bank (see e.g. https://forum.juce.com/t/iirfilter-help/1733/7 ).
-void _setNumFilters( const unsigned int numBands, const unsigned int numSourceImages )
+    double fc = 31.5 * std::pow( 2.0, i ); // band center
+    if( i < NUM_OCTAVE_BANDS - 2 ){ return fc + ( 2*fc - fc )/2; }
+    return fc + ( 20000 - fc )/2;
+}
+
+// Decompose source buffer into bands, return multi-channel buffer with one band per channel.
+// Uses no internal buffer: thread safe as long as each thread works on different filter states.
+void decomposeBuffer( const AudioBuffer<float> & source, AudioBuffer<float> & destination, FilterState & state ) const
 {
-    // resize band buffer
-    _numOctaveBands = numBands;
-    _numIndptStream = numSourceImages;
-    octaveFilterBanks.resize( numSourceImages );
-    
-    // loop over bands of each filterbank
-    double fc; // cutoff frequency
-    double fcMid;
-    for( int j = 0; j < numSourceImages; j++ )
+    decompose( source.getReadPointer(0), destination, state );
+}
+
+// Decompose numLanes source signals at once, each with its own filter state, into numLanes multi-channel
+// buffers (see decomposeBuffer). Sources are filtered in parallel, one per SIMD lane: all filters are run
+// sample by sample on 4 samples of each source at a time, remaining spectrum computed in the same loop.
+// Uses no internal buffer: thread safe as long as each thread works on different filter states.
+void decomposeBuffers( const float* const* sources, AudioBuffer<float>* const* destinations, FilterState* const* states ) const
+{
+#if SIMD_FLOAT4
+    const int numFilters = numOctaveBands - 1;
+    
+    // coefficients and states of all filters, one source per lane
+    float4 c[NUM_OCTAVE_BANDS-1][5];
+    float4 v1[NUM_OCTAVE_BANDS-1];
+    float4 v2[NUM_OCTAVE_BANDS-1];
+    for( int i = 0; i < numFilters; i++ )
     {
-        if( numBands == 10 ) // 10-filter-bank
+        for( int m = 0; m < 5; m++ ){ c[i][m] = set4( coefficients[i].coefficients[m] ); }
+        v1[i] = setr4( states[0]->v1[i], states[1]->v1[i], states[2]->v1[i], states[3]->v1[i] );
+        v2[i] = setr4( states[0]->v2[i], states[1]->v2[i], states[2]->v2[i], states[3]->v2[i] );
+    }
+    
+    float* bands[numLanes][NUM_OCTAVE_BANDS];
+    for( int l = 0; l < numLanes; l++ )
+    {
+        for( int i = 0; i < numOctaveBands; i++ ){ bands[l][i] = destinations[l]->getWritePointer(i); }
+    }
+    
+    // x[t]: sample n+t of each source, remaining spectrum once filters 0..i are subtracted
+    float4 x[4];
+    float4 y[4];
+    int n = 0;
+    for( ; n + 4 <= localSamplesPerBlockExpected; n += 4 )
+    {
+        x[0] = load4( sources[0] + n ); x[1] = load4( sources[1] + n );
+        x[2] = load4( sources[2] + n ); x[3] = load4( sources[3] + n );
+        transpose4( x[0], x[1], x[2], x[3] );
+        
+        for( int i = 0; i < numFilters; i++ )
         {
-            fc = 31.5;
-            for( int i = 0; i < _numOctaveBands-1; i++ )
+            float4 lv1 = v1[i];
+            float4 lv2 = v2[i];
+            for( int t = 0; t < 4; t++ )
             {
-                // get lowpass cut-off freq (in between "would be Fc" for bandpass, arbitrary choice)
-                if( i < _numOctaveBands - 2 ){ fcMid = fc + ( 2*fc - fc )/2; }
-                // last fcMid is not "mid between next and current" but "between max and current"
-                else{ fcMid = fc + ( 20000 - fc )/2; }
-                
-                octaveFilterBanks[j][i].setCoefficients( IIRCoefficients::makeLowPass( localSampleRate, fcMid ) );
-                // octaveFilterBanks[j][i].reset();
-                fc *= 2;
+                y[t] = madd4( c[i][0], x[t], lv1 );
+                lv1 = add4( sub4( mul4( c[i][1], x[t] ), mul4( c[i][3], y[t] ) ), lv2 );
+                lv2 = sub4( mul4( c[i][2], x[t] ), mul4( c[i][4], y[t] ) );
+                x[t] = sub4( x[t], y[t] );
             }
+            v1[i] = lv1;
+            v2[i] = lv2;
+            
+            transpose4( y[0], y[1], y[2], y[3] );
+            for( int l = 0; l < numLanes; l++ ){ store4( bands[l][i] + n, y[l] ); }
         }
         
-        else // 3-filter-bank
+        transpose4( x[0], x[1], x[2], x[3] );
+        for( int l = 0; l < numLanes; l++ ){ store4( bands[l][numFilters] + n, x[l] ); }
+    }
+    
+    // remaining samples (block size not a multiple of 4), one at a time
+    alignas(16) float lanes[numLanes];
+    for( ; n < localSamplesPerBlockExpected; n++ )
+    {
+        x[0] = setr4( sources[0][n], sources[1][n], sources[2][n], sources[3][n] );
+        for( int i = 0; i < numFilters; i++ )
         {
-            fc = 480;
-            octaveFilterBanks[j][0].setCoefficients( IIRCoefficients::makeLowPass( localSampleRate, fc ) );
-            // octaveFilterBanks[j][0].reset(); // removed all resets to avoid zipper noise when changing existing filters, may need to re-add them
-
-            fc = 8200;
-            octaveFilterBanks[j][1].setCoefficients( IIRCoefficients::makeLowPass( localSampleRate, fc ) );
-            // octaveFilterBanks[j][1].reset();
+            y[0] = madd4( c[i][0], x[0], v1[i] );
+            v1[i] = add4( sub4( mul4( c[i][1], x[0] ), mul4( c[i][3], y[0] ) ), v2[i] );
+            v2[i] = sub4( mul4( c[i][2], x[0] ), mul4( c[i][4], y[0] ) );
+            x[0] = sub4( x[0], y[0] );
+            
+            store4( lanes, y[0] );
+            for( int l = 0; l < numLanes; l++ ){ bands[l][i][n] = lanes[l]; }
         }
+        store4( lanes, x[0] );
+        for( int l = 0; l < numLanes; l++ ){ bands[l][numFilters][n] = lanes[l]; }
+    }
+    
+    // hand back states
+    for( int i = 0; i < numFilters; i++ )
+    {
+        store4( lanes, v1[i] );
+        for( int l = 0; l < numLanes; l++ ){ JUCE_SNAP_TO_ZERO( lanes[l] );  states[l]->v1[i] = lanes[l]; }
+        store4( lanes, v2[i] );
+        for( int l = 0; l < numLanes; l++ ){ JUCE_SNAP_TO_ZERO( lanes[l] );  states[l]->v2[i] = lanes[l]; }
     }
+#else
+    for( int l = 0; l < numLanes; l++ ){ decompose( sources[l], *destinations[l], *states[l] ); }
+#endif
 }
 
-// Decompose source buffer into bands, return multi-channel buffer with one band per channel
-void decomposeBuffer( const AudioBuffer<float> & source, AudioBuffer<float> & destination, const unsigned int sourceImageId )
+private:
+
+// compute lowpass filters of both designs for current sampling rate. Each band is the lowpass filtered remaining
+// spectrum, subtracted from it for the next bands: bands add up to the input whatever the filters.
+void designFilters()
 {
-    if( updateRequired ){
-        // update filters
-        _setNumFilters( numOctaveBands, numIndptStream );
-        // flag update no longer required
-        updateRequired = false;
-    }
-    
-    // prepare buffers
-    bufferRemains = source;
+    for( int i = 0; i < coefficients10Bands.size(); i++ ){ coefficients10Bands[i] = IIRCoefficients::makeLowPass( localSampleRate, getCrossoverFrequency( 10, i ) ); }
+    for( int i = 0; i < coefficients3Bands.size(); i++ ){ coefficients3Bands[i] = IIRCoefficients::makeLowPass( localSampleRate, getCrossoverFrequency( 3, i ) ); }
+}
+
+// scalar decomposition of one source signal (see decomposeBuffer)
+void decompose( const float* source, AudioBuffer<float> & destination, FilterState & state ) const
+{
+    // remaining spectrum is kept in last band channel
+    float* remains = destination.getWritePointer( numOctaveBands-1 );
+    FloatVectorOperations::copy( remains, source, localSamplesPerBlockExpected );
     
     // recursive filtering for all but last band
-    for( int i = 0; i < _numOctaveBands-1; i++ )
+    for( int i = 0; i < numOctaveBands-1; i++ )
     {
         // filter the remaining spectrum
-        bufferFiltered = bufferRemains;
-        octaveFilterBanks[sourceImageId][i].processSamples( bufferFiltered.getWritePointer(0), localSamplesPerBlockExpected );
+        float* band = destination.getWritePointer(i);
+        processLowPass( remains, band, i, state );
         
         // substract just processed band from remaining spectrum
-        bufferFiltered.applyGain( -1.f );
-        bufferRemains.addFrom( 0, 0, bufferFiltered, 0, 0, localSamplesPerBlockExpected );
-        bufferFiltered.applyGain( -1.f );
-        
-        // add filtered band to output
-        destination.copyFrom( i, 0, bufferFiltered, 0, 0, localSamplesPerBlockExpected );
+        FloatVectorOperations::subtract( remains, band, localSamplesPerBlockExpected );
     }
-    
-    // last band
-    destination.copyFrom( _numOctaveBands-1, 0, bufferRemains, 0, 0, localSamplesPerBlockExpected );
+}
+
+// lowpass filter i of the bank, from input to output (same as IIRFilter::processSamples)
+void processLowPass( const float* input, float* output, const int i, FilterState & state ) const
+{
+    const float* c = coefficients[i].coefficients;
+    float lv1 = state.v1[i];
+    float lv2 = state.v2[i];
+    for( int n = 0; n < localSamplesPerBlockExpected; n++ )
+    {
+        const float in = input[n];
+        const float out = c[0] * in + lv1;
+        lv1 = c[1] * in - c[3] * out + lv2;
+        lv2 = c[2] * in - c[4] * out;
+        output[n] = out;
+    }
+    JUCE_SNAP_TO_ZERO( lv1 );  state.v1[i] = lv1;
+    JUCE_SNAP_TO_ZERO( lv2 );  state.v2[i] = lv2;
 }
     
 JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FilterBank)
@@ -8,9 +8,7 @@ oscHandler(),
 clippingLed( *this ),
 audioIOComponent(),
 audioRecorder(),
-delayLine(),
-sourceImagesHandler(),
-ambi2binContainer()
+auralizationEngine()
 {
     // set window dimensions
     setSize (650, 700);
@@ -195,10 +193,6 @@ void MainContentComponent::prepareToPlay (int samplesPerBlockExpected, double sa
     // recorder
     audioRecorder.prepareToPlay (samplesPerBlockExpected, sampleRate);
     
-    // working buffer
-    workingBuffer.setSize(1, samplesPerBlockExpected);
-    // ambisonic buffer holds 2 stereo channels (first) + ambisonic channels
-    ambisonicBuffer.setSize(2 + N_AMBI_CH, samplesPerBlockExpected);
     // because of stupid design choice of ambisonicBuffer, require this additional ambisonicRecordBuffer. to clean..
     ambisonicRecordBuffer.setSize(N_AMBI_CH, samplesPerBlockExpected);
     
@@ -206,41 +200,25 @@ void MainContentComponent::prepareToPlay (int samplesPerBlockExpected, double sa
     localSampleRate = sampleRate;
     localSamplesPerBlockExpected = samplesPerBlockExpected;
     
-    // init delay line
-    delayLine.prepareToPlay(samplesPerBlockExpected, sampleRate);
-    delayLine.setSize(1, sampleRate); // arbitrary length of 1 sec
-    sourceImagesHandler.prepareToPlay (samplesPerBlockExpected, sampleRate);
-    
-    // init ambi 2 bin decoding: fill in data in ABIR filtered and ABIR filter themselves
-    for( int i = 0; i < N_AMBI_CH; i++ )
-    {
-        ambi2binFilters[ 2*i ].init(samplesPerBlockExpected, AMBI2BIN_IR_LENGTH);
-        ambi2binFilters[ 2*i ].setImpulseResponse(ambi2binContainer.ambi2binIrDict[i][0].data()); // [ch x ear x sampID]
-        ambi2binFilters[2*i+1].init(samplesPerBlockExpected, AMBI2BIN_IR_LENGTH);
-        ambi2binFilters[2*i+1].setImpulseResponse(ambi2binContainer.ambi2binIrDict[i][1].data()); // [ch x ear x sampID]
-    }
+    // init audio processing chain (delay line, source images, ambi 2 bin decoding)
+    auralizationEngine.prepareToPlay (samplesPerBlockExpected, sampleRate);
 }
 
 // Audio Processing (split in "processAmbisonicBuffer" and "fillNextAudioBlock" to enable
 // IR recording: using the same methods as the main thread)
 void MainContentComponent::getNextAudioBlock (const AudioSourceChannelInfo& bufferToFill)
 {
-    // check if update required
-    if( updateNumFreqBandrequired ){
-        sourceImagesHandler.setFilterBankSize(numFreqBands);
-        updateNumFreqBandrequired = false;
-        // trigger general update: must re-dimension abs.coeffs and trigger update future->current, see in function
-        sourceImagesHandler.updateFromOscHandler(oscHandler);
-    }
-    
     // fill buffer with audiofile data
     audioIOComponent.getNextAudioBlock(bufferToFill);
     
-    // execute main audio processing
-    if( !isRecordingIr )
+    // execute main audio processing (engine left to recordIr while recording)
+    if( !isRecordingIr.load() )
     {
-        processAmbisonicBuffer( bufferToFill.buffer );
-        if( audioRecorder.isRecording() ){ recordAmbisonicBuffer(); }
+        // check if update required (source images scene, delay interpolation)
+        auralizationEngine.applyPendingUpdates();
+        
+        auralizationEngine.processAmbisonicBuffer( bufferToFill.buffer );
+        if( audioRecorder.isRecording() ){ recordAmbisonicBuffer(); }
         fillNextAudioBlock( bufferToFill.buffer );
     }
     // simply clear output buffer
@@ -248,100 +226,19 @@ void MainContentComponent::getNextAudioBlock (const AudioSourceChannelInfo& buff
     {
         bufferToFill.clearActiveBufferRegion();
     }
-    
-    // check if source images need update (i.e. update called by OSC handler
-    // while source images in the midst of a crossfade
-    if( sourceImageHandlerNeedsUpdate && sourceImagesHandler.crossfadeOver )
-    {
-        sourceImagesHandler.updateFromOscHandler(oscHandler);
-        requireDelayLineSizeUpdate = true;
-        sourceImageHandlerNeedsUpdate = false;
-    }
-}
-
-// Audio Processing: split from getNextAudioBlock to use it for recording IR
-void MainContentComponent::processAmbisonicBuffer( AudioBuffer<float> *const audioBufferToFill )
-{
-    workingBuffer.copyFrom(0, 0, audioBufferToFill->getWritePointer(0), workingBuffer.getNumSamples());
-    
-    //==========================================================================
-    // SOURCE IMAGE PROCESSING
-    
-    if ( sourceImagesHandler.numSourceImages > 0 )
-    {
-        
-        //==========================================================================
-        // DELAY LINE
-        
-        // update delay line size if need be (TODO: MOVE THIS .SIZE() OUTSIDE OF AUDIO PROCESSING LOOP
-        if ( requireDelayLineSizeUpdate )
-        {
-            // get maximum required delay line duration
-            float maxDelay = sourceImagesHandler.getMaxDelayFuture();
-            
-            // get associated required delay line buffer length
-            int updatedDelayLineLength = (int)( 1.5 * maxDelay * localSampleRate); // longest delay creates noisy sound if delay line is exactly 1* its duration
-            
-            // update delay line size
-            delayLine.setSize(1, updatedDelayLineLength);
-            
-            // unflag update required
-            requireDelayLineSizeUpdate = false;
-        }
-        
-        // add current audio buffer to delay line
-        delayLine.copyFrom(0, workingBuffer, 0, 0, workingBuffer.getNumSamples());
-        
-        // loop over sources images, apply delay + room coloration + spatialization
-        sourceImagesHandler.getNextAudioBlock( & delayLine, ambisonicBuffer );
-        
-        // increment delay line write position
-        delayLine.incrementWritePosition(workingBuffer.getNumSamples());
-        
-    }
-    
 }
 
+// Audio Processing: Ambisonic to binaural decoding, split from getNextAudioBlock to use it for recording IR
 void MainContentComponent::fillNextAudioBlock( AudioBuffer<float> *const audioBufferToFill )
 {
-    
-    //==========================================================================
     // SPATIALISATION: Ambisonic decoding + virtual speaker approach + binaural
-    
-    if ( sourceImagesHandler.numSourceImages > 0 )
-    {
-        // duplicate channel before filtering for two ears
-        ambisonicBuffer2ndEar = ambisonicBuffer;
-
-        // loop over Ambisonic channels
-        for (int k = 0; k < N_AMBI_CH; k++)
-        {
-            ambi2binFilters[ 2*k ].process(ambisonicBuffer.getWritePointer(k+2)); // left
-            ambi2binFilters[2*k+1].process(ambisonicBuffer2ndEar.getWritePointer(k+2)); // right
-            
-            // collapse left channel, collapse right channel
-            ambisonicBuffer.addFrom(0, 0, ambisonicBuffer.getWritePointer(2+k), workingBuffer.getNumSamples());
-            ambisonicBuffer2ndEar.addFrom(1, 0, ambisonicBuffer2ndEar.getWritePointer(2+k), workingBuffer.getNumSamples());
-        }
-
-        // final rewrite to output buffer
-        audioBufferToFill->copyFrom(0, 0, ambisonicBuffer, 0, 0, workingBuffer.getNumSamples());
-        audioBufferToFill->copyFrom(1, 0, ambisonicBuffer2ndEar, 1, 0, workingBuffer.getNumSamples());
-    }
-    
-    //==========================================================================
-    // if no source image, simply rewrite to output buffer (TODO: remove stupid double copy)
-    else
-    {
-        audioBufferToFill->copyFrom(0, 0, workingBuffer, 0, 0, workingBuffer.getNumSamples());
-        audioBufferToFill->copyFrom(1, 0, workingBuffer, 0, 0, workingBuffer.getNumSamples());
-    }
+    auralizationEngine.fillNextAudioBlock( audioBufferToFill );
     
     //==========================================================================
     // CLIP OUTPUT (DEBUG PRECAUTION)
     auto outL = audioBufferToFill->getWritePointer(0);
     auto outR = audioBufferToFill->getWritePointer(1);
-    for (int i = 0; i < workingBuffer.getNumSamples(); i++)
+    for (int i = 0; i < localSamplesPerBlockExpected; i++)
     {
         outL[i] = clipOutput(outL[i]);
         outR[i] = clipOutput(outR[i]);
@@ -351,7 +248,8 @@ void MainContentComponent::fillNextAudioBlock( AudioBuffer<float> *const audioBu
 // record Ambisonic buffer to disk
 void MainContentComponent::recordAmbisonicBuffer()
 {
-    if ( sourceImagesHandler.numSourceImages > 0 )
+    const AudioBuffer<float> & ambisonicBuffer = auralizationEngine.ambisonicBuffer;
+    if ( auralizationEngine.sourceImagesHandler.numSourceImages > 0 )
     {
         // loop over Ambisonic channels to extract only ambisonic channels. I know, stupid. Needs cleaning
         for (int k = 0; k < N_AMBI_CH; k++)
@@ -362,7 +260,7 @@ void MainContentComponent::recordAmbisonicBuffer()
     // if no source image, data in ambisonicBuffer is meaningless: copy content of workingbuffer (raw input) rather
     else{
         ambisonicRecordBuffer.clear();
-        ambisonicRecordBuffer.copyFrom(0, 0, workingBuffer, 0, 0, ambisonicBuffer.getNumSamples());
+        ambisonicRecordBuffer.copyFrom(0, 0, auralizationEngine.workingBuffer, 0, 0, ambisonicBuffer.getNumSamples());
     }
     
     // write to disk
@@ -396,8 +294,7 @@ void MainContentComponent::recordIr()
     recordingBufferInput.getWritePointer(0)[0] = 1.0f;
     
     // clear delay lines / fdn buffers of main thread
-    delayLine.clear();
-    sourceImagesHandler.reverbTail.clear();
+    auralizationEngine.clear();
     
     // pass impulse input into processing loop until IR faded below threshold
     float rms = 1.0f;
@@ -410,12 +307,12 @@ void MainContentComponent::recordIr()
         if( bufferId >= 1 ){ recordingBufferInput.clear(); }
         
         // execute main audio processing: fill ambisonic buffer
-        processAmbisonicBuffer( &recordingBufferInput );
+        auralizationEngine.processAmbisonicBuffer( &recordingBufferInput );
         
         // add to output ambisonic buffer
         for( int k = 0; k < N_AMBI_CH; k++ )
         {
-            recordingBufferAmbisonicOutput.addFrom(k, bufferId*localSamplesPerBlockExpected, ambisonicBuffer, k+2, 0, localSamplesPerBlockExpected);
+            recordingBufferAmbisonicOutput.addFrom(k, bufferId*localSamplesPerBlockExpected, auralizationEngine.ambisonicBuffer, k+2, 0, localSamplesPerBlockExpected);
         }
         
         // ambisonic to stereo
@@ -453,8 +350,7 @@ void MainContentComponent::releaseResources()
     audioIOComponent.transportSource.releaseResources();
     
     // clear all "delay line" like buffers
-    delayLine.clear();
-    sourceImagesHandler.reverbTail.clear();
+    auralizationEngine.clear();
 }
 
 
@@ -480,17 +376,8 @@ void MainContentComponent::updateOnOscReceive()
     // running the sourceImagesHandler.updateFromOscHandler method that reads them OSC internals.
     oscHandler.updateInternals();
     
-    // if sourceImagesHandler not in the midst of an update
-    if( sourceImagesHandler.crossfadeOver && !sourceImageHandlerNeedsUpdate )
-    {
-        // update source images attributes based on latest received OSC info
-        sourceImagesHandler.updateFromOscHandler(oscHandler);
-        
-        // now that everything is ready: set update flag, to resize delay line at next audio loop
-        requireDelayLineSizeUpdate = true;
-    }
-    // otherwise, flag that an update is required
-    else{ sourceImageHandlerNeedsUpdate = true; }
+    // update source images attributes based on latest received OSC info (applied by the audio thread at its next block)
+    auralizationEngine.updateFromOscHandler(oscHandler);
 }
 
 //==============================================================================
@@ -580,7 +467,7 @@ void MainContentComponent::buttonClicked (Button* button)
 {
     if (button == &saveIrButton)
     {
-        if ( sourceImagesHandler.numSourceImages > 0 )
+        if ( auralizationEngine.sourceImagesHandler.numSourceImages > 0 )
         {
             isRecordingIr = true;
             recordIr();
@@ -596,13 +483,13 @@ void MainContentComponent::buttonClicked (Button* button)
     }
     if( button == &reverbTailToggle )
     {
-        sourceImagesHandler.enableReverbTail = reverbTailToggle.getToggleState();
+        auralizationEngine.sourceImagesHandler.enableReverbTail = reverbTailToggle.getToggleState();
         updateOnOscReceive(); // require delay line size update
         gainReverbTailSlider.setEnabled(reverbTailToggle.getToggleState());
     }
     if( button == &enableDirectToBinaural )
     {
-        sourceImagesHandler.enableDirectToBinaural = enableDirectToBinaural.getToggleState();
+        auralizationEngine.sourceImagesHandler.enableDirectToBinaural = enableDirectToBinaural.getToggleState();
     }
     if( button == &enableLog )
     {
@@ -627,12 +514,9 @@ void MainContentComponent::comboBoxChanged(ComboBox* comboBox)
 {
     if (comboBox == &numFrequencyBandsComboBox)
     {
-        // update locals
-        if( numFrequencyBandsComboBox.getSelectedId() == 1 ) numFreqBands = 3;
-        else numFreqBands = 10;
-        
-        // flag update required in audio loop (to avoid multi-thread access issues)
-        updateNumFreqBandrequired = true;
+        // update locals, applied in audio loop (to avoid multi-thread access issues)
+        if( numFrequencyBandsComboBox.getSelectedId() == 1 ) auralizationEngine.setNumFreqBands(3, oscHandler);
+        else auralizationEngine.setNumFreqBands(10, oscHandler);
     }
     if (comboBox == &srcDirectivityComboBox)
     {
@@ -641,9 +525,10 @@ void MainContentComponent::comboBoxChanged(ComboBox* comboBox)
         if( comboBox->getSelectedId() == 1 ) filename = "omni.sofa";
         else filename = "directional.sofa";
         const char *fileChar = filename.c_str();
-        sourceImagesHandler.directivityHandler.loadFile( fileChar );
+        auralizationEngine.sourceImagesHandler.directivityHandler.loadFile( fileChar );
         
-        // update 
+        // update (directivity gains of all source images)
+        auralizationEngine.sourceImagesHandler.invalidateSourceImages();
         updateOnOscReceive();
     }
 }
@@ -652,20 +537,20 @@ void MainContentComponent::sliderValueChanged(Slider* slider)
 {
     if( slider == &gainReverbTailSlider )
     {
-        sourceImagesHandler.reverbTailGain = gainReverbTailSlider.getValue();
+        auralizationEngine.sourceImagesHandler.reverbTailGain = gainReverbTailSlider.getValue();
     }
     if( slider == &gainDirectPathSlider )
     {
-        sourceImagesHandler.directPathGain = gainDirectPathSlider.getValue();
+        auralizationEngine.sourceImagesHandler.directPathGain = gainDirectPathSlider.getValue();
     }
     if( slider == &gainEarlySlider )
     {
-        sourceImagesHandler.earlyGain = slider->getValue();
+        auralizationEngine.sourceImagesHandler.earlyGain = slider->getValue();
     }
     if( slider == &crossfadeStepSlider )
     {
-        sourceImagesHandler.crossfadeStep = slider->getValue();
-        sourceImagesHandler.binauralEncoder.crossfadeStep = slider->getValue();
+        auralizationEngine.sourceImagesHandler.crossfadeStep = slider->getValue();
+        auralizationEngine.sourceImagesHandler.binauralEncoder.crossfadeStep = slider->getValue();
     }
 }
 
@@ -5,13 +5,11 @@
 #include "OSCHandler.h"
 #include "AudioIOComponent.h"
 #include "AudioRecorder.h"
-#include "Ambi2binIRContainer.h"
-#include "FIRFilter/FIRFilter.h"
 #include "Utils.h" // used to define constants
-#include "DelayLine.h"
-#include "SourceImagesHandler.h"
+#include "AuralizationEngine.h"
 #include "LedComponent.h"
 
+#include <atomic>
 #include <vector>
 #include <array>
 #include <unordered_map>
@@ -41,7 +39,6 @@ public:
     void getNextAudioBlock (const AudioSourceChannelInfo& bufferToFill) override;
     void releaseResources() override;
     
-    void processAmbisonicBuffer( AudioBuffer<float> *const audioBufferToFill );
     void fillNextAudioBlock( AudioBuffer<float> *const audioBufferToFill );
     void recordAmbisonicBuffer();
     void recordIr();
@@ -64,7 +61,7 @@ private:
     double localSampleRate;
     int localSamplesPerBlockExpected;
     OSCHandler oscHandler; // receive OSC messages, ready them for other components
-    bool isRecordingIr = false;
+    std::atomic<bool> isRecordingIr { false }; // audio processing left to recordIr (message thread)
     
     //==========================================================================
     // GUI ELEMENTS
@@ -103,10 +100,10 @@ private:
     // AUDIO COMPONENTS
 
     // buffers
-    AudioBuffer<float> workingBuffer; // working buffer
     AudioBuffer<float> recordingBufferOutput; // recording buffer
     AudioBuffer<float> recordingBufferAmbisonicOutput; // recording buffer
     AudioBuffer<float> recordingBufferInput; // recording buffer
+    AudioBuffer<float> ambisonicRecordBuffer;
     
     // audio player (GUI + audio reader + adc input)
     AudioIOComponent audioIOComponent;
@@ -114,24 +111,8 @@ private:
     // audio stream recorder
     AudioRecorder audioRecorder;
     
-    // delay line
-    DelayLine delayLine;
-    bool requireDelayLineSizeUpdate = false;
-    
-    // sources images
-    SourceImagesHandler sourceImagesHandler;
-    bool sourceImageHandlerNeedsUpdate = false;
-    
-    // Ambisonic to binaural decoding
-    AudioBuffer<float> ambisonicBuffer;
-    AudioBuffer<float> ambisonicRecordBuffer;
-    AudioBuffer<float> ambisonicBuffer2ndEar;
-    Ambi2binIRContainer ambi2binContainer;
-    FIRFilter ambi2binFilters[2*N_AMBI_CH]; // holds current ABIR (room reverb) filters
-    
-    // frequency band
-    int numFreqBands = 0;
-    bool updateNumFreqBandrequired = false;
+    // audio processing chain: delay line, sources images, Ambisonic to binaural decoding
+    AuralizationEngine auralizationEngine;
    
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MainContentComponent)
 };
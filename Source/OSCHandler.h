@@ -4,6 +4,7 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "Utils.h"
 #include <map>
+#include <set>
 #include <vector>
 #include <math.h>
 
@@ -28,6 +29,12 @@ private:
         std::map<String,EL_Source> sourceMap;
         std::map<String,EL_Listener> listenerMap;
         std::vector<float> valuesR60;
+        
+        // changes received since last updateInternals
+        std::set<int> updatedSourceImageIds; // source images added, updated or removed
+        bool sourceImageMapCleared = false;
+        bool sourceMoved = false;
+        bool listenerMoved = false;
     };
     
     localVariablesStruct *current = new localVariablesStruct();
@@ -38,10 +45,11 @@ private:
 
 public:
 
-OSCHandler()
+// connectToPort set to false when state is loaded from file rather than received (see loadMapContentFromLog)
+OSCHandler( const bool connectToPort = true )
 {
     // if failed to connect
-    if( !connect(port) )
+    if( connectToPort && !connect(port) )
     {
         showConnectionErrorMessage ("Error: (OSC) could not connect to localhost@" + String(port) + ".");
     }
@@ -98,13 +106,9 @@ std::vector<Eigen::Vector3f> getSourceImageDOAs()
 	// discard if empty listener map
 	if( current->listenerMap.size() == 0 ){ return doas; }
     
-	Eigen::Vector3f listenerPos = current->listenerMap.begin()->second.position;
-    Eigen::Matrix3f listenerRotationMatrix = current->listenerMap.begin()->second.rotationMatrix;
-    
     int i = 0;
     for( auto const &ent1 : current->sourceImageMap ){
-        Eigen::Vector3f posSph = cartesianToSpherical( listenerRotationMatrix * ( ent1.second.positionRelectionLast - listenerPos ) );
-        doas[i] = posSph;
+        doas[i] = getDOA( ent1.second );
         i ++;
     }
     return doas;
@@ -118,24 +122,73 @@ std::vector<Eigen::Vector3f> getSourceImageDODs()
 
 	// discard if empty source map
 	if( current->sourceMap.size() == 0 ){ return dods; }
-
-    Eigen::Vector3f sourcePos = current->sourceMap.begin()->second.position;
-    Eigen::Matrix3f sourceRotationMatrix = current->sourceMap.begin()->second.rotationMatrix;
     
     int i = 0;
     for( auto const &ent1 : current->sourceImageMap ) {
-        Eigen::Vector3f posSph = cartesianToSpherical( sourceRotationMatrix * ( ent1.second.positionRelectionFirst - sourcePos ) );
-        dods[i] = posSph;
+        dods[i] = getDOD( ent1.second );
         i ++;
     }
     return dods;
 }
-    
+
+bool hasSourceImage( const int sourceID )
+{
+    return current->sourceImageMap.count(sourceID) > 0;
+}
+
+float getSourceImagePathLength( const int sourceID )
+{
+    return current->sourceImageMap.find(sourceID)->second.totalPathDistance;
+}
+
+// number of reflections of a given source image (0 for the direct path)
+int getSourceImageReflectionOrder( const int sourceID )
+{
+    return current->sourceImageMap.find(sourceID)->second.reflectionOrder;
+}
+
+// get Direction Of Arrival of a given source image (zero if no listener)
+Eigen::Vector3f getSourceImageDOA( const int sourceID )
+{
+    if( current->listenerMap.size() == 0 ){ return Eigen::Vector3f::Zero(); }
+    return getDOA( current->sourceImageMap.find(sourceID)->second );
+}
+
+// get Direction Of Departure of a given source image (zero if no source)
+Eigen::Vector3f getSourceImageDOD( const int sourceID )
+{
+    if( current->sourceMap.size() == 0 ){ return Eigen::Vector3f::Zero(); }
+    return getDOD( current->sourceImageMap.find(sourceID)->second );
+}
+
 Array<float> getSourceImageAbsorption( const unsigned int sourceID )
 {
     return current->sourceImageMap.find(sourceID)->second.absorption;
 }
 
+// source images added, updated or removed by last updateInternals (incomplete if source image map was cleared)
+const std::set<int> & getUpdatedSourceImageIDs()
+{
+    return current->updatedSourceImageIds;
+}
+
+// true if source image map was cleared before last updateInternals: all source images to be considered updated
+bool isSourceImageMapCleared()
+{
+    return current->sourceImageMapCleared;
+}
+
+// true if source / listener position or orientation changed in last updateInternals
+bool hasSourceMoved()
+{
+    return current->sourceMoved;
+}
+
+bool hasListenerMoved()
+{
+    return current->listenerMoved;
+}
+
 std::vector<float> getRT60Values()
 {
     return current->valuesR60;
@@ -278,10 +331,84 @@ String getMapContentForLog()
     return output;
 }
     
+// load state from string formatted as getMapContentForLog output (e.g. saved OSC state), to be
+// followed by a call to updateInternals as for received messages
+void loadMapContentFromLog( const String & content )
+{
+    StringArray lines = StringArray::fromLines( content );
+    
+    for( int l = 0; l < lines.size(); l++ )
+    {
+        StringArray tokens = StringArray::fromTokens( lines[l], false );
+        if( tokens.size() == 0 ){ continue; }
+        
+        // format: [ listener: name pos: x y z rot: r00 r01 .. r22 ]
+        if( tokens[0] == "listener:" && tokens.size() == 16 )
+        {
+            EL_Listener listener;
+            listener.name = tokens[1];
+            for( int i = 0; i < 3; i++ ){ listener.position(i) = tokens[3+i].getFloatValue(); }
+            for( int j = 0; j < 3; j++ )
+            {
+                for( int k = 0; k < 3; k++ )
+                {
+                    listener.rotationMatrix(j,k) = tokens[7 + (3*j + k)].getFloatValue();
+                }
+            }
+            future->listenerMap[listener.name] = listener;
+            future->listenerMoved = true;
+        }
+        
+        // format: [ source: name pos: x y z rot: r00 r01 .. r22 ]
+        else if( tokens[0] == "source:" && tokens.size() == 16 )
+        {
+            EL_Source source;
+            source.name = tokens[1];
+            for( int i = 0; i < 3; i++ ){ source.position(i) = tokens[3+i].getFloatValue(); }
+            for( int j = 0; j < 3; j++ )
+            {
+                for( int k = 0; k < 3; k++ )
+                {
+                    source.rotationMatrix(j,k) = tokens[7 + (3*j + k)].getFloatValue();
+                }
+            }
+            future->sourceMap[source.name] = source;
+            future->sourceMoved = true;
+        }
+        
+        // format: [ rt60: rt1 .. rtN ]
+        else if( tokens[0] == "rt60:" )
+        {
+            for( int i = 1; i < tokens.size() && i <= NUM_OCTAVE_BANDS; i++ ){ future->valuesR60[i-1] = tokens[i].getFloatValue(); }
+        }
+        
+        // format: [ imgSrc: pathID order: n posFirst: x y z posLast: x y z pathLength: dist abs: abs1 .. abs10 ]
+        else if( tokens[0] == "imgSrc:" && tokens.size() == 25 )
+        {
+            EL_ImageSource source;
+            source.ID = tokens[1].getIntValue();
+            source.reflectionOrder = tokens[3].getIntValue();
+            for( int i = 0; i < 3; i++ )
+            {
+                source.positionRelectionFirst(i) = tokens[5+i].getFloatValue();
+                source.positionRelectionLast(i) = tokens[9+i].getFloatValue();
+            }
+            source.totalPathDistance = tokens[13].getFloatValue();
+            for( int i = 0; i < 10; i++ )
+            {
+                source.absorption.insert(i, tokens[15+i].getFloatValue());
+            }
+            future->sourceImageMap[source.ID] = source;
+            future->updatedSourceImageIds.insert(source.ID);
+        }
+    }
+}
+    
 // reset all internals
 void clear( const bool force )
 {
     future->sourceImageMap.clear();
+    future->sourceImageMapCleared = true;
     future->valuesR60.clear();
     future->valuesR60.resize(NUM_OCTAVE_BANDS, 0.f);
     
@@ -289,22 +416,58 @@ void clear( const bool force )
     {
         future->sourceMap.clear();
         future->listenerMap.clear();
+        future->sourceMoved = true;
+        future->listenerMoved = true;
     }
 }
 
-// swap future with current state
+// swap future with current state. Message thread only: messages are received on the message thread (MessageLoopCallback)
+// and the audio thread never reads OSC handler state, only scenes built from it (see SceneState)
 void updateInternals()
 {
     std::swap(current, future);
-    // udpate new future (old current) to make sure next swap won't give me deprecated values
-    future->sourceImageMap = current->sourceImageMap;
+    
+    // udpate new future (old current) to make sure next swap won't give me deprecated values. Only source
+    // images changed since last swap are copied, rather than the whole map (unless it has been cleared)
+    if( current->sourceImageMapCleared ){ future->sourceImageMap = current->sourceImageMap; }
+    else
+    {
+        for( int sourceID : current->updatedSourceImageIds )
+        {
+            auto sourceImage = current->sourceImageMap.find(sourceID);
+            if( sourceImage == current->sourceImageMap.end() ){ future->sourceImageMap.erase(sourceID); }
+            else{ future->sourceImageMap[sourceID] = sourceImage->second; }
+        }
+    }
     future->sourceMap = current->sourceMap;
     future->listenerMap = current->listenerMap;
     future->valuesR60 = current->valuesR60;
+    
+    // reset change tracking (changes of this update remain readable from current)
+    future->updatedSourceImageIds.clear();
+    future->sourceImageMapCleared = false;
+    future->sourceMoved = false;
+    future->listenerMoved = false;
 }
 
 private:
 
+// Direction Of Arrival of a source image (relative to listener orientation), listener map must not be empty
+Eigen::Vector3f getDOA( const EL_ImageSource & sourceImage )
+{
+    Eigen::Vector3f listenerPos = current->listenerMap.begin()->second.position;
+    Eigen::Matrix3f listenerRotationMatrix = current->listenerMap.begin()->second.rotationMatrix;
+    return cartesianToSpherical( listenerRotationMatrix * ( sourceImage.positionRelectionLast - listenerPos ) );
+}
+
+// Direction Of Departure of a source image (relative to source orientation), source map must not be empty
+Eigen::Vector3f getDOD( const EL_ImageSource & sourceImage )
+{
+    Eigen::Vector3f sourcePos = current->sourceMap.begin()->second.position;
+    Eigen::Matrix3f sourceRotationMatrix = current->sourceMap.begin()->second.rotationMatrix;
+    return cartesianToSpherical( sourceRotationMatrix * ( sourceImage.positionRelectionFirst - sourcePos ) );
+}
+
 void oscMessageReceived (const OSCMessage & msg) override
 {
     OSCAddressPattern pIn("/in");
@@ -337,6 +500,7 @@ void oscMessageReceived (const OSCMessage & msg) override
         
         // insert or update
         future->sourceImageMap[source.ID] = source;
+        future->updatedSourceImageIds.insert(source.ID);
     }
     
     else if( pR60.matches(msgAdress) )
@@ -398,6 +562,7 @@ void oscBundleReceived( const OSCBundle & bundle ) override
             
             // insert or update
             future->sourceMap[source.name] = source;
+            future->sourceMoved = true;
         }
         else if ( pListener.matches(msgAdress) )
         {
@@ -417,10 +582,12 @@ void oscBundleReceived( const OSCBundle & bundle ) override
             
             // insert or update
             future->listenerMap[listener.name] = listener;
+            future->listenerMoved = true;
         }
         else if ( pOut.matches(msgAdress) )
         {
             future->sourceImageMap.erase(msg[0].getInt32());
+            future->updatedSourceImageIds.insert(msg[0].getInt32());
         }
     }
     
@@ -16,11 +16,13 @@ public:
     static const int numOctaveBands = 3;
     static const int MAX_FDN_ORDER = 16;
     static const int fdnOrder = 16;
-    
+    static const int numBusChannels = fdnOrder*numOctaveBands;
+
 private:
     
     // local delay line
     DelayLine delayLine;
+    std::array<float, numBusChannels> delayAllpassStates; // per channel delay line read state (Thiran interpolation)
     
     // setup FDN (static FDN order of 16 is max for now)
     std::array<unsigned int, MAX_FDN_ORDER> fdnDelays; // in samples
@@ -45,6 +47,7 @@ public:
         
         // init local attributes
         valuesRT60.resize( numOctaveBands, 0.0f );
+        delayAllpassStates.fill( 0.f );
         
         // define FDN parameters
         defineFdnFeedbackMatrix();
@@ -56,14 +59,14 @@ public:
     void prepareToPlay( const unsigned int samplesPerBlockExpected, const double sampleRate )
     {
         // prepare buffers
-        reverbBusBuffers.setSize(fdnOrder*numOctaveBands, samplesPerBlockExpected);
+        reverbBusBuffers.setSize(numBusChannels, samplesPerBlockExpected);
         reverbBusBuffers.clear();
         tailBuffer.setSize(fdnOrder, samplesPerBlockExpected);
         workingBuffer.setSize(1, samplesPerBlockExpected, false, true);
         
         // init delay line
         delayLine.prepareToPlay(samplesPerBlockExpected, sampleRate);
-        delayLine.setSize(fdnOrder*numOctaveBands, sampleRate); // debug: set delay line max size
+        delayLine.setSize(fdnOrder*numOctaveBands, sampleRate); // 1 sec, longer than longest FDN delay
         
         // keep local copies
         localSampleRate = sampleRate;
@@ -73,29 +76,47 @@ public:
         updateFdnParameters();
     }
     
-    // update FDN gains and cie based on new RT60 values
+    // update FDN gains and cie based on new RT60 values (10 bands)
     void updateInternals( const std::vector<float> & rt60Values )
+    {
+        setRT60Values( from10to3bands( rt60Values ) );
+    }
+    
+    // update FDN gains based on new RT60 values given for numOctaveBands bands (no allocation, audio thread safe)
+    void setRT60Values( const std::vector<float> & rt60Values )
     {
         // store new RT60 values
-        valuesRT60 = from10to3bands( rt60Values );
+        std::copy( rt60Values.begin(), rt60Values.begin() + numOctaveBands, valuesRT60.begin() );
         
-        // increase fdn delay line length if need be
-        float maxDelay = getMaxValue(valuesRT60);
-        delayLine.setSize(fdnOrder*numOctaveBands, maxDelay*localSampleRate);
+        // no delay line resize here (called while the audio thread runs): FDN delays are fixed
+        // (see updateFdnParameters), the delay line allocated in prepareToPlay is long enough
         
         // update FDN parameters
         updateFdnParameters();
     }
     
+    // set FDN delay lines fractional delay interpolation, not to be called while the audio thread runs extractBusToBuffer
+    void setDelayInterpolation( const DelayLine::Interpolation interpolation )
+    {
+        delayLine.setInterpolation( interpolation );
+        delayAllpassStates.fill( 0.f );
+    }
+    
     // add source image to reverberation bus for latter use
     void addToBus( const unsigned int busId, const AudioBuffer<float> & source )
+    {
+        addToBus( reverbBusBuffers, busId, source, localSamplesPerBlockExpected );
+    }
+    
+    // add source image to a (e.g. thread local) partial reverberation bus buffer of numBusChannels channels
+    static void addToBus( AudioBuffer<float> & busBuffers, const unsigned int busId, const AudioBuffer<float> & source, const int numSamples )
     {
         // If main thread operates with 3 bands
         if( source.getNumChannels() == 3 )
         {
             for( int k = 0; k < source.getNumChannels(); k++ )
             {
-                reverbBusBuffers.addFrom(k*fdnOrder+busId, 0, source, k, 0, localSamplesPerBlockExpected);
+                busBuffers.addFrom(k*fdnOrder+busId, 0, source, k, 0, numSamples);
             }
         }
         // If main thread operates with 10 bands (reduce to 3 here)
@@ -103,15 +124,24 @@ public:
             // low frequencies
             for( int k = 0; k < 5; k++ )
             {
-                reverbBusBuffers.addFrom(0*fdnOrder+busId, 0, source, k, 0, localSamplesPerBlockExpected);
+                busBuffers.addFrom(0*fdnOrder+busId, 0, source, k, 0, numSamples);
             }
             // mid frequencies
             for( int k = 5; k < 9; k++ )
             {
-                reverbBusBuffers.addFrom(1*fdnOrder+busId, 0, source, k, 0, localSamplesPerBlockExpected);
+                busBuffers.addFrom(1*fdnOrder+busId, 0, source, k, 0, numSamples);
             }
             // last band
-            reverbBusBuffers.addFrom(2*fdnOrder+busId, 0, source, 9, 0, localSamplesPerBlockExpected);
+            busBuffers.addFrom(2*fdnOrder+busId, 0, source, 9, 0, numSamples);
+        }
+    }
+    
+    // add partial reverberation bus buffer (see above) to reverberation bus
+    void addBusBuffers( const AudioBuffer<float> & busBuffers )
+    {
+        for( int k = 0; k < numBusChannels; k++ )
+        {
+            reverbBusBuffers.addFrom(k, 0, busBuffers, k, 0, localSamplesPerBlockExpected);
         }
     }
     
@@ -136,7 +166,7 @@ public:
                 delayLine.addFrom( bufferIndex, reverbBusBuffers, bufferIndex, 0, localSamplesPerBlockExpected );
                 
                 // read output from delay line (erase current content of reverbBuffers)
-                delayLine.fillBufferWithDelayedChunk( reverbBusBuffers, bufferIndex, 0, bufferIndex, fdnDelays[fdnId], localSamplesPerBlockExpected );
+                delayLine.fillBufferWithDelayedChunk( reverbBusBuffers, bufferIndex, 0, bufferIndex, fdnDelays[fdnId], localSamplesPerBlockExpected, delayAllpassStates[bufferIndex] );
                 
                 // apply FDN gains
                 reverbBusBuffers.applyGain(bufferIndex, 0, localSamplesPerBlockExpected, fdnGains[bandId][fdnId]);
@@ -177,6 +207,7 @@ public:
     {
         reverbBusBuffers.clear();
         delayLine.clear();
+        delayAllpassStates.fill( 0.f );
     }
     
 private:
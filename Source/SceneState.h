@@ -0,0 +1,261 @@
+#ifndef SCENESTATE_H_INCLUDED
+#define SCENESTATE_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "Utils.h"
+#include "FilterBank.h"
+#include "ColorationFIR.h"
+#include "AmbisonicMatrixEncoder.h"
+#include <atomic>
+#include <array>
+#include <complex>
+#include <memory>
+#include <vector>
+
+// rendering level of detail of a source image, from most to least detailed (see SourceImagesHandler::getLevelOfDetail)
+enum class LevelOfDetail : char
+{
+    Full, // band gains (filter bank / FIR), 2nd order Ambisonic encoding
+    Broadband, // single gain: filter bank / FIR skipped
+    ReverbTailOnly, // broadband, fed to the reverb tail only: not Ambisonic encoded
+    Culled // not rendered (faded out)
+};
+
+// Audio thread state of source images, stored per processing slot: a source image keeps the slot given by the
+// message thread (see SourceImagesHandler::allocateSlot) until erased, so that its state (ramps, delay taps,
+// filters) follows it whatever its position in the scene. Parameters are ramped from their value at last change
+// (start) to their target value, independently for each source image (see SourceImagesHandler::delaySourceImage).
+// Per band / per channel values are stored as contiguous blocks, e.g. start gain of band k of slot s is
+// bandGainsStart[s*NUM_OCTAVE_BANDS + k]
+struct SourceImageSlots
+{
+    std::vector<int> ids; // id of source image in slot, -1 if none
+    std::vector<int> revisions; // revision of source image parameters ramped to
+    std::vector<float> rampPositions; // from 0 (start values) to 1 (target values, ramp over)
+    std::vector<float> levelsStart; // fade in / out level
+    std::vector<float> levelsTarget;
+    std::vector<float> bandGainsStart; // absorption * directivity gains [numSlots x NUM_OCTAVE_BANDS]
+    std::vector<float> bandGainsTarget;
+    std::vector<float> ambisonicGainsStart; // [numSlots x N_AMBI_CH]
+    std::vector<float> ambisonicGainsTarget;
+    std::vector<char> removalNotified; // removed source image faded out and reported to the message thread
+    std::vector<char> colorationBypassed; // filter bank / FIR skipped (flat band gains, other mode): their state to be reset before next use
+    std::vector<LevelOfDetail> levelsOfDetail; // level of detail ramped to
+    
+    // delay taps ramp from start to end delay / path length gain, end being the target unless changed while
+    // crossfading two taps (then ramped to once the crossfade is over)
+    std::vector<float> delayRampPositions; // from 0 (start tap) to 1 (end tap)
+    std::vector<float> delaysStart; // in seconds
+    std::vector<float> delaysEnd; // in seconds
+    std::vector<float> gainsStart; // path length gain
+    std::vector<float> gainsEnd; // path length gain
+    std::vector<float> delayAllpassStatesStart; // delay line read state of start tap (Thiran interpolation)
+    std::vector<float> delayAllpassStates; // delay line read state of end tap
+    
+    // octave filter bank state
+    std::vector<FilterBank::FilterState> filterStates;
+    
+    // FIR coloration (see ColorationFIR): FIR spectra ramp from start to target, and last input samples
+    std::vector<std::complex<float>> firSpectraStart; // [numSlots x ColorationFIR::numBins]
+    std::vector<std::complex<float>> firSpectraTarget;
+    std::vector<float> firHistories; // [numSlots x ColorationFIR::firLength]
+    
+    int size() const { return ids.size(); }
+    
+    // allocate numSlots empty slots (not on the audio thread)
+    void resize( const int numSlots )
+    {
+        ids.assign( numSlots, -1 );
+        revisions.assign( numSlots, 0 );
+        rampPositions.assign( numSlots, 1.f );
+        levelsStart.assign( numSlots, 0.f );
+        levelsTarget.assign( numSlots, 0.f );
+        bandGainsStart.assign( numSlots * NUM_OCTAVE_BANDS, 0.f );
+        bandGainsTarget.assign( numSlots * NUM_OCTAVE_BANDS, 0.f );
+        ambisonicGainsStart.assign( numSlots * N_AMBI_CH, 0.f );
+        ambisonicGainsTarget.assign( numSlots * N_AMBI_CH, 0.f );
+        removalNotified.assign( numSlots, 0 );
+        colorationBypassed.assign( numSlots, 1 );
+        levelsOfDetail.assign( numSlots, LevelOfDetail::Full );
+        delayRampPositions.assign( numSlots, 1.f );
+        delaysStart.assign( numSlots, 0.f );
+        delaysEnd.assign( numSlots, 0.f );
+        gainsStart.assign( numSlots, 0.f );
+        gainsEnd.assign( numSlots, 0.f );
+        delayAllpassStatesStart.assign( numSlots, 0.f );
+        delayAllpassStates.assign( numSlots, 0.f );
+        filterStates.assign( numSlots, FilterBank::FilterState() );
+        firSpectraStart.assign( numSlots * ColorationFIR::numBins, 0.f );
+        firSpectraTarget.assign( numSlots * ColorationFIR::numBins, 0.f );
+        firHistories.assign( numSlots * ColorationFIR::firLength, 0.f );
+    }
+    
+    // copy state of all slots of other (not larger) into the first slots, no allocation (audio thread safe)
+    void copyFrom( const SourceImageSlots & other )
+    {
+        jassert( other.size() <= size() );
+        std::copy( other.ids.begin(), other.ids.end(), ids.begin() );
+        std::copy( other.revisions.begin(), other.revisions.end(), revisions.begin() );
+        std::copy( other.rampPositions.begin(), other.rampPositions.end(), rampPositions.begin() );
+        std::copy( other.levelsStart.begin(), other.levelsStart.end(), levelsStart.begin() );
+        std::copy( other.levelsTarget.begin(), other.levelsTarget.end(), levelsTarget.begin() );
+        std::copy( other.bandGainsStart.begin(), other.bandGainsStart.end(), bandGainsStart.begin() );
+        std::copy( other.bandGainsTarget.begin(), other.bandGainsTarget.end(), bandGainsTarget.begin() );
+        std::copy( other.ambisonicGainsStart.begin(), other.ambisonicGainsStart.end(), ambisonicGainsStart.begin() );
+        std::copy( other.ambisonicGainsTarget.begin(), other.ambisonicGainsTarget.end(), ambisonicGainsTarget.begin() );
+        std::copy( other.removalNotified.begin(), other.removalNotified.end(), removalNotified.begin() );
+        std::copy( other.colorationBypassed.begin(), other.colorationBypassed.end(), colorationBypassed.begin() );
+        std::copy( other.levelsOfDetail.begin(), other.levelsOfDetail.end(), levelsOfDetail.begin() );
+        std::copy( other.delayRampPositions.begin(), other.delayRampPositions.end(), delayRampPositions.begin() );
+        std::copy( other.delaysStart.begin(), other.delaysStart.end(), delaysStart.begin() );
+        std::copy( other.delaysEnd.begin(), other.delaysEnd.end(), delaysEnd.begin() );
+        std::copy( other.gainsStart.begin(), other.gainsStart.end(), gainsStart.begin() );
+        std::copy( other.gainsEnd.begin(), other.gainsEnd.end(), gainsEnd.begin() );
+        std::copy( other.delayAllpassStatesStart.begin(), other.delayAllpassStatesStart.end(), delayAllpassStatesStart.begin() );
+        std::copy( other.delayAllpassStates.begin(), other.delayAllpassStates.end(), delayAllpassStates.begin() );
+        std::copy( other.filterStates.begin(), other.filterStates.end(), filterStates.begin() );
+        std::copy( other.firSpectraStart.begin(), other.firSpectraStart.end(), firSpectraStart.begin() );
+        std::copy( other.firSpectraTarget.begin(), other.firSpectraTarget.end(), firSpectraTarget.begin() );
+        std::copy( other.firHistories.begin(), other.firHistories.end(), firHistories.begin() );
+    }
+};
+
+// Scene state used by the audio thread (source images parameters, reverb tail and listener related values),
+// computed from OSC info on the message thread then handed over as a whole (see SceneStateExchange).
+// per band / per channel values are stored as contiguous (structure of arrays) blocks,
+// e.g. gain of band k of source image j is bandGains[j*numBands + k]
+struct SceneState
+{
+    // source images (target parameters)
+    int numBands = 0; // number of frequency bands in bandGains
+    int numRemoved = 0; // number of source images flagged as removed
+    std::vector<int> ids; // source images indices
+    std::vector<float> delays; // in seconds
+    std::vector<float> pathLengths; // in meters
+    std::vector<float> bandGains; // room absorption * source directivity gains [numImages x numBands]
+    bool useFirColoration = false; // band gains applied by minimum phase FIRs rather than by the filter bank
+    std::vector<std::complex<float>> firSpectra; // FIR of band gains [numImages x ColorationFIR::numBins], FIR coloration only
+    std::vector<float> ambisonicGains; // Ambisonic encoding gains [numImages x N_AMBI_CH]
+    std::vector<int> reflectionOrders; // number of reflections (0 for the direct path)
+    std::vector<float> energies; // predicted energy: (path length gain * mean band gain)^2
+    std::vector<int> energyRanks; // rank by predicted energy, 0 for the loudest (direct path first, removed source images last)
+    int maxReflectionOrder = 0;
+    std::vector<int> revisions; // scene update count at last change of source image parameters
+    std::vector<char> removed; // source image removed from the scene, listed until faded out
+    
+    // source images processing slots (see SourceImageSlots)
+    std::vector<int> slots; // slot of each source image, unique within the scene
+    int numSlots = 0; // slots in use or released so far (all slot indices are below)
+    std::unique_ptr<SourceImageSlots> grownSlots; // larger slot storage if numSlots exceeds the audio thread's one
+    std::unique_ptr<AmbisonicMatrixEncoder::SignalMatrix> grownSourceSignals; // Ambisonic encoder signals, as many as grownSlots
+    
+    std::vector<float> ambisonicGainsBlock; // Ambisonic encoding gains at current block start [numImages x N_AMBI_CH] (audio thread)
+    
+    // reverb tail
+    std::vector<float> valuesRT60; // 3 bands, in sec
+    
+    // listener: direct path direction of arrival (binaural encoding)
+    int directPathId = -1; // source image id, -1 if none
+    float directPathAzimuth = 0.f;
+    float directPathElevation = 0.f;
+    
+    // size per source image vectors for numImages source images, values to be filled
+    void resize( const int numImages, const int numFreqBands, const bool firColoration = false )
+    {
+        numBands = numFreqBands;
+        useFirColoration = firColoration;
+        ids.resize( numImages );
+        delays.resize( numImages );
+        pathLengths.resize( numImages );
+        bandGains.resize( numImages * numBands );
+        firSpectra.resize( useFirColoration ? numImages * ColorationFIR::numBins : 0 );
+        ambisonicGains.resize( numImages * N_AMBI_CH );
+        reflectionOrders.resize( numImages );
+        energies.resize( numImages );
+        energyRanks.resize( numImages );
+        revisions.resize( numImages );
+        removed.assign( numImages, 0 );
+        slots.resize( numImages );
+        ambisonicGainsBlock.assign( numImages * N_AMBI_CH, 0.f );
+    }
+};
+
+// Lock-free hand over of scene snapshots from one publishing thread (message thread) to the audio thread.
+// A snapshot is published once fully built (release) and read by the audio thread after acquiring it (acquire):
+// it is never modified by the publisher afterwards. Only the latest published snapshot matters: one not yet
+// acquired is replaced, and deleted, by the next publish. Snapshots the audio thread is done with are retired
+// to a lock-free fifo, deleted by the publisher at next publish: no allocation / deallocation on the audio thread.
+class SceneStateExchange
+{
+
+//==========================================================================
+// ATTRIBUTES
+
+private:
+    
+    static const int retiredCapacity = 8;
+    
+    std::atomic<SceneState*> pending { nullptr };
+    std::array<SceneState*, retiredCapacity> retired;
+    AbstractFifo retiredFifo { retiredCapacity };
+
+//==========================================================================
+// METHODS
+
+public:
+
+SceneStateExchange()
+{
+    retired.fill( nullptr );
+}
+
+~SceneStateExchange()
+{
+    delete pending.exchange( nullptr );
+    reclaimRetired();
+}
+
+// publish snapshot (ownership transferred), publishing thread only
+void publish( SceneState* snapshot )
+{
+    reclaimRetired();
+    
+    // replaced snapshot was never seen by the audio thread (acquire empties pending slot)
+    delete pending.exchange( snapshot, std::memory_order_acq_rel );
+}
+
+// get latest published snapshot (ownership transferred) or nullptr if none since last call, audio thread only.
+// Left pending while there is no room to retire a snapshot, so that each acquire can be followed by a retire.
+SceneState* acquire()
+{
+    if( retiredFifo.getFreeSpace() == 0 ){ return nullptr; }
+    return pending.exchange( nullptr, std::memory_order_acquire );
+}
+
+// hand back a snapshot no longer used by the audio thread (at most one per acquired snapshot), audio thread only
+void retire( SceneState* snapshot )
+{
+    int start1, size1, start2, size2;
+    retiredFifo.prepareToWrite( 1, start1, size1, start2, size2 );
+    jassert( size1 == 1 );
+    retired[start1] = snapshot;
+    retiredFifo.finishedWrite( 1 );
+}
+
+private:
+
+// delete snapshots retired by the audio thread, publishing thread only
+void reclaimRetired()
+{
+    int start1, size1, start2, size2;
+    retiredFifo.prepareToRead( retiredFifo.getNumReady(), start1, size1, start2, size2 );
+    for( int i = 0; i < size1; i++ ){ delete retired[start1 + i]; }
+    for( int i = 0; i < size2; i++ ){ delete retired[start2 + i]; }
+    retiredFifo.finishedRead( size1 + size2 );
+}
+
+JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SceneStateExchange)
+
+};
+
+#endif // SCENESTATE_H_INCLUDED
@@ -0,0 +1,68 @@
+#pragma once
+
+// minimal 4 x float vector shim (SSE2 / NEON), shared by the FFT, delay line and filter code.
+// SIMD_FLOAT4 is 0 when no vector unit is available: callers then only run their scalar loop.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define SIMD_FLOAT4 1
+	typedef __m128 float4;
+	static inline float4 load4(const float* p) { return _mm_loadu_ps(p); }
+	static inline void store4(float* p, float4 v) { _mm_storeu_ps(p, v); }
+	static inline float4 set4(float v) { return _mm_set1_ps(v); }
+	static inline float4 add4(float4 a, float4 b) { return _mm_add_ps(a, b); }
+	static inline float4 sub4(float4 a, float4 b) { return _mm_sub_ps(a, b); }
+	static inline float4 mul4(float4 a, float4 b) { return _mm_mul_ps(a, b); }
+	static inline float4 interleaveLow4(float4 a, float4 b) { return _mm_unpacklo_ps(a, b); }
+	static inline float4 interleaveHigh4(float4 a, float4 b) { return _mm_unpackhi_ps(a, b); }
+	static inline float4 setr4(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+	static inline float lastLane4(float4 v) { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))); }
+	static inline float sum4(float4 v) { float4 s = _mm_add_ps(v, _mm_movehl_ps(v, v)); return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1))); }
+	// shift lanes up by n, zeros shifted in: (v0, v1, v2, v3) -> (0, v0, v1, v2) for n = 1
+	template <int n> static inline float4 shiftUp4(float4 v) { return _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4 * n)); }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define SIMD_FLOAT4 1
+	typedef float32x4_t float4;
+	static inline float4 load4(const float* p) { return vld1q_f32(p); }
+	static inline void store4(float* p, float4 v) { vst1q_f32(p, v); }
+	static inline float4 set4(float v) { return vdupq_n_f32(v); }
+	static inline float4 add4(float4 a, float4 b) { return vaddq_f32(a, b); }
+	static inline float4 sub4(float4 a, float4 b) { return vsubq_f32(a, b); }
+	static inline float4 mul4(float4 a, float4 b) { return vmulq_f32(a, b); }
+	static inline float4 interleaveLow4(float4 a, float4 b) { return vzipq_f32(a, b).val[0]; }
+	static inline float4 interleaveHigh4(float4 a, float4 b) { return vzipq_f32(a, b).val[1]; }
+	static inline float4 setr4(float a, float b, float c, float d) { const float v[4] = { a, b, c, d }; return vld1q_f32(v); }
+	static inline float lastLane4(float4 v) { return vgetq_lane_f32(v, 3); }
+	static inline float sum4(float4 v) { float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v)); return vget_lane_f32(vpadd_f32(s, s), 0); }
+	template <int n> static inline float4 shiftUp4(float4 v) { return vextq_f32(vdupq_n_f32(0.f), v, 4 - n); }
+#else
+	#define SIMD_FLOAT4 0
+#endif
+
+#if SIMD_FLOAT4
+	// a * b + c
+	static inline float4 madd4(float4 a, float4 b, float4 c) { return add4(mul4(a, b), c); }
+
+	// in place 4x4 transpose of (a, b, c, d): a = a0 b0 c0 d0, b = a1 b1 c1 d1, ...
+	static inline void transpose4(float4& a, float4& b, float4& c, float4& d)
+	{
+		float4 ac0 = interleaveLow4(a, c), ac1 = interleaveHigh4(a, c);
+		float4 bd0 = interleaveLow4(b, d), bd1 = interleaveHigh4(b, d);
+		a = interleaveLow4(ac0, bd0);
+		b = interleaveHigh4(ac0, bd0);
+		c = interleaveLow4(ac1, bd1);
+		d = interleaveHigh4(ac1, bd1);
+	}
+
+	// store 4x4 transpose of (a, b, c, d): p[0..3] = a0 b0 c0 d0, p[4..7] = a1 b1 c1 d1, ...
+	static inline void store4Transposed(float* p, float4 a, float4 b, float4 c, float4 d)
+	{
+		float4 ac0 = interleaveLow4(a, c), ac1 = interleaveHigh4(a, c);
+		float4 bd0 = interleaveLow4(b, d), bd1 = interleaveHigh4(b, d);
+		store4(p, interleaveLow4(ac0, bd0));
+		store4(p + 4, interleaveHigh4(ac0, bd0));
+		store4(p + 8, interleaveLow4(ac1, bd1));
+		store4(p + 12, interleaveHigh4(ac1, bd1));
+	}
+#endif
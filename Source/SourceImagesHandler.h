@@ -3,10 +3,19 @@
 
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "AmbixEncode/AmbixEncoder.h"
+#include "AmbisonicMatrixEncoder.h"
+#include "WorkerPool.h"
 #include "BinauralEncoder.h"
 #include "FilterBank.h"
+#include "ColorationFIR.h"
 #include "ReverbTail.h"
+#include "ConvolutionReverbTail.h"
 #include "DirectivityHandler.h"
+#include "SceneState.h"
+#include "CpuBudgetController.h"
+#include <limits>
+#include <numeric>
+#include <tuple>
 
 class SourceImagesHandler
 {
@@ -25,17 +34,25 @@ public:
     
     // reverb tail
     ReverbTail reverbTail;
+    ConvolutionReverbTail convolutionReverbTail; // replaces FDN reverb tail when loaded
     bool enableReverbTail;
     float reverbTailGain = 1.0f;
     
     // direct path to binaural
-    int directPathId = -1;
     float directPathGain = 1.0f;
     bool enableDirectToBinaural = true;
     
-    // crossfade mechanism
+    // per source image parameters ramp: ramp position increment per block (see delaySourceImage)
     float crossfadeStep = 0.1f;
-    bool crossfadeOver = true;
+    
+    // ramp the delay of modified source images (single tap, Doppler) instead of crossfading old and new delay
+    // taps. Images whose delay jumps faster than maxDelayRampRate (in samples of delay per sample, i.e. relative
+    // pitch shift) are crossfaded nonetheless.
+    bool enableDelayRamping = false;
+    float maxDelayRampRate = 0.1f;
+    
+    // number of threads processing source images (calling audio thread included), applied at next prepareToPlay
+    int numWorkerThreads = 1;
     
     // direct binaural encoding (for direct path only)
     BinauralEncoder binauralEncoder;
@@ -43,27 +60,142 @@ public:
     // source / listener directivity
     DirectivityHandler directivityHandler;
     
-    // prepare struct for thread safe update (pointer swap based)
-    struct localVariablesStruct
+    // number of frequency bands of scenes built by updateFromOscHandler (message thread)
+    int numFreqBands = NUM_OCTAVE_BANDS;
+    
+    // room coloration of scenes built by updateFromOscHandler (message thread): one minimum phase FIR per source
+    // image (see ColorationFIR) instead of the filter bank
+    bool enableFirColoration = false;
+    
+    // clustering of source images in scenes built by updateFromOscHandler (see clusterSourceImages): source images
+    // of reflection order minClusteredOrder and above whose direction of arrival falls in the same clusterAngle grid
+    // cell (azimuth / elevation, in degrees), and whose delay falls in the same clusterDelay bin (in sec), are
+    // rendered as one virtual source image. Its direction / delay is off by at most one cell / bin from theirs.
+    bool enableClustering = false;
+    int minClusteredOrder = 3;
+    float clusterAngle = 10.f;
+    float clusterDelay = 0.001f;
+    
+    // level of detail of source images (see getLevelOfDetail): source images of reflection order above
+    // maxFullDetailOrder, or whose predicted energy is below fullDetailThreshold, get a single broadband gain
+    // (filter bank / FIR skipped). Above maxEncodedOrder, or below encodedThreshold, they only feed the reverb
+    // tail (not Ambisonic encoded). Only the maxRenderedImages loudest source images (predicted energy) are
+    // rendered, the others are faded out. The direct path is always rendered in full detail.
+    struct LevelOfDetailPolicy
     {
-        std::vector<int> ids; // source images indices
-        std::vector<float> delays; // in seconds
-        std::vector<float> pathLengths; // in meters
-        std::vector< Array<float> > absorptionCoefs; // room frequency absorption coefficients
-        std::vector< Array<float> > directivityGains; // source directivity gains
-        std::vector< Array<float> > ambisonicGains; // buffer for input data
+        int maxFullDetailOrder = 100;
+        int maxEncodedOrder = 100;
+        float fullDetailThreshold = -200.f; // predicted energy, in dB
+        float encodedThreshold = -200.f;
+        int maxRenderedImages = std::numeric_limits<int>::max();
+        
+        bool operator!= ( const LevelOfDetailPolicy & other ) const
+        {
+            return maxFullDetailOrder != other.maxFullDetailOrder || maxEncodedOrder != other.maxEncodedOrder
+                || fullDetailThreshold != other.fullDetailThreshold || encodedThreshold != other.encodedThreshold
+                || maxRenderedImages != other.maxRenderedImages;
+        }
     };
+    LevelOfDetailPolicy levelOfDetailPolicy;
+    
+    // CPU budget of getNextAudioBlock: over budget, the reflection orders of the level of detail policy are
+    // lowered one at a time (full detail one first, then encoded one, down to 1st order reflections), then the
+    // quietest source images are culled. Detail is given back in reverse order once under budget (see
+    // updateLevelOfDetail)
+    CpuBudgetController cpuBudget;
     
-    localVariablesStruct *current = new localVariablesStruct();
-    localVariablesStruct *future = new localVariablesStruct();
+    // scene state processed by the audio thread, owned by it (see applyPendingScene)
+    SceneState *current = new SceneState();
     
+    // source images state of the audio thread, per processing slot (see SceneState::slots), owned by it
+    std::unique_ptr<SourceImageSlots> slots { new SourceImageSlots() };
+
 private:
     
+    // scenes published by updateFromOscHandler, acquired by the audio thread
+    SceneStateExchange sceneExchange;
+    
+    // source images parameters as of last published scene (message thread), only the ones
+    // changed since are recomputed by updateFromOscHandler
+    struct sourceImageStruct
+    {
+        int revision = 0; // scene update count at last parameters change
+        int reflectionOrder = 0;
+        float pathLength = 0.f; // in meters
+        float azimuth = 0.f; // direction of arrival
+        float elevation = 0.f;
+        std::array<float, NUM_OCTAVE_BANDS> absorptionCoefs;
+        std::array<float, NUM_OCTAVE_BANDS> directivityGains;
+        std::array<float, NUM_OCTAVE_BANDS> bandGains; // absorption * directivity (see getBandGain)
+        ComplexVector<float> firSpectrum; // FIR of band gains, FIR coloration only
+        std::array<float, N_AMBI_CH> ambisonicGains;
+        bool removed = false; // being faded out by the audio thread, erased once it is done
+        int slot = -1; // processing slot, kept until erased (see allocateSlot)
+        bool clustered = false; // rendered through its cluster: faded out, then left out of scenes
+        bool clusteredFadedOut = false;
+        std::tuple<int, int, int> clusterKey; // clusters only: grid cell (azimuth, elevation, delay)
+    };
+    std::map<int, sourceImageStruct> sourceImages;
+    
+    // clusters (virtual source images, see clusterSourceImages) are stored along with source images, under ids
+    // below -1 (given per grid cell, kept until the cluster is erased)
+    std::map<std::tuple<int, int, int>, int> clusterIds;
+    int nextClusterId = -2;
+    int sceneRevision = 0;
+    int sceneNumBands = 0;
+    bool sceneFirColoration = false;
+    bool updateAllSourceImages = true;
+    ColorationFIR firDesigner; // FIR design of updated source images (message thread)
+    
+    // processing slots allocation (message thread): slots of erased source images are reused first
+    std::vector<int> freeSlots;
+    int numSlots = 0; // slots allocated so far
+    std::atomic<int> slotCapacity { 0 }; // number of slots of the audio thread storage (and encoder signals), set by the audio thread
+    
+    // removed source images (id, revision) faded out by the audio thread, reported to the message thread
+    static const int fadedOutCapacity = 1024;
+    std::array<std::pair<int, int>, fadedOutCapacity> fadedOutSourceImages;
+    AbstractFifo fadedOutFifo { fadedOutCapacity };
+    
+    // per thread processing context: the source images list is split in chunks of imagesPerChunk, claimed by the
+    // audio thread and the worker threads (see WorkerPool)
+    static const int imagesPerChunk = FilterBank::numLanes;
+    struct processingContextStruct
+    {
+        AudioBuffer<float> workingBuffer; // working buffer, one channel per filter bank lane (delayed source images)
+        std::array<AudioBuffer<float>, FilterBank::numLanes> bandBuffers; // N band buffers returned by the filterbank for f(freq) absorption
+        AudioBuffer<float> scratchBuffer; // single channel, binaural encoder input / Ambisonic gains ramp
+        AudioBuffer<float> reverbBusBuffers; // partial reverb tail bus, summed to reverb tail bus once all workers are done
+        AudioBuffer<float> broadbandBusBuffers; // partial reverb tail bus of source images not band decomposed (flat band gains, FIR coloration), fdnOrder channels
+        bool hasBroadbandBus = false; // broadbandBusBuffers written during current block
+        AudioBuffer<float> ambisonicRampBuffer; // Ambisonic gains change of ramping source images over the block
+        bool hasAmbisonicRamps = false; // ambisonicRampBuffer written during current block
+        
+        // source images decomposed at once by the filter bank, one per lane (see processLanes)
+        struct laneStruct
+        {
+            int sourceImage; // index in current scene
+            float rampStart; // ramp progress over the block
+            float rampEnd;
+            std::array<float, NUM_OCTAVE_BANDS> bandGains; // absorption * directivity gains over the block
+            bool isFlat; // all band gains are equal: filter bank / FIR skipped
+        };
+        std::array<laneStruct, FilterBank::numLanes> lanes;
+        std::array<FilterBank::FilterState, FilterBank::numLanes> spareFilterStates; // filter states of unused lanes
+        ColorationFIR colorationFIR; // FIR coloration (FFT and buffers of the worker)
+    };
+    std::vector<processingContextStruct> processingContexts;
+    WorkerPool workerPool;
+    
+    // arguments of current getNextAudioBlock call, shared with worker threads
+    DelayLine* blockDelayLine = nullptr;
+    AudioBuffer<float>* blockAmbisonicBuffer = nullptr;
+    
+    // reverb tail input of source images not band decomposed, summed per bus then band decomposed once per bus
+    AudioBuffer<float> broadbandBusBuffer;
+    std::array<FilterBank::FilterState, ReverbTail::fdnOrder> broadbandBusFilterStates;
+    
     // audio buffers
-    AudioBuffer<float> workingBuffer; // working buffer
-    AudioBuffer<float> workingBufferTemp; // 2nd working buffer, e.g. for crossfade mechanism
-    AudioBuffer<float> clipboardBuffer; // to be used as local copy of working buffer when working buffer modified in loops
-    AudioBuffer<float> bandBuffer; // N band buffer returned by the filterbank for f(freq) absorption
     AudioBuffer<float> tailBuffer; // FDN_ORDER band buffer returned by the FDN reverb tail
     AudioBuffer<float> binauralBuffer; // stereo buffer to handle binaural encoder output
     
@@ -71,11 +203,27 @@ private:
     double localSampleRate;
     int localSamplesPerBlockExpected;
     
-    // crossfade mechanism
-    float crossfadeGain = 0.0;
+    // per sample ramp from 1/numSamples to 1 over a block
+    std::vector<float> blockRamp;
+    
+    // direct path position not yet passed to the binaural encoder (see applyPendingScene)
+    bool directPathPositionPending = false;
+    
+    // level of detail in use (audio thread): policy and reverb tail state as of last update, lowered by
+    // lodSteps CPU budget reductions into the limits of getLevelOfDetail
+    LevelOfDetailPolicy lodPolicy;
+    bool lodReverbTail = false;
+    int lodSteps = 0;
+    int lodCullingLimit = std::numeric_limits<int>::max(); // CPU budget limit on the number of rendered source images
+    int lodMaxFullDetailOrder = 0;
+    int lodMaxEncodedOrder = 0;
+    float lodFullDetailEnergy = 0.f;
+    float lodEncodedEnergy = 0.f;
+    int lodMaxRenderedImages = 0;
     
     // ambisonic encoding
     AmbixEncoder ambisonicEncoder;
+    AmbisonicMatrixEncoder ambisonicMatrixEncoder; // encodes all source images at once
     AudioBuffer<float> ambisonicBuffer; // output buffer, N (Ambisonic) channels
     
 //==========================================================================
@@ -85,18 +233,37 @@ public:
     
 SourceImagesHandler() {}
 
-~SourceImagesHandler() {}
+~SourceImagesHandler()
+{
+    workerPool.stop();
+    delete current;
+}
 
 // local equivalent of prepareToPlay
 void prepareToPlay( const unsigned int samplesPerBlockExpected, const double sampleRate )
 {
+    // (re)start worker threads
+    workerPool.stop();
+    int numWorkers = jmax( 1, numWorkerThreads );
+    if( numWorkers > 1 ){ workerPool.start( numWorkers, [this]( int threadId, int chunkId ){ processSourceImagesChunk( threadId, chunkId ); } ); }
+    
     // prepare buffers
-    workingBuffer.setSize(1, samplesPerBlockExpected);
-    workingBuffer.clear();
-    workingBufferTemp = workingBuffer;
-    clipboardBuffer = workingBuffer;
-    bandBuffer.setSize(NUM_OCTAVE_BANDS, samplesPerBlockExpected);
+    processingContexts.resize( numWorkers );
+    for( auto & context : processingContexts )
+    {
+        context.workingBuffer.setSize(FilterBank::numLanes, samplesPerBlockExpected);
+        context.workingBuffer.clear();
+        for( auto & bandBuffer : context.bandBuffers ){ bandBuffer.setSize(NUM_OCTAVE_BANDS, samplesPerBlockExpected); }
+        context.scratchBuffer.setSize(1, samplesPerBlockExpected);
+        context.reverbBusBuffers.setSize(ReverbTail::numBusChannels, samplesPerBlockExpected);
+        context.broadbandBusBuffers.setSize(ReverbTail::fdnOrder, samplesPerBlockExpected);
+        context.ambisonicRampBuffer.setSize(N_AMBI_CH, samplesPerBlockExpected);
+        context.colorationFIR.prepareToPlay( samplesPerBlockExpected, sampleRate );
+    }
     binauralBuffer.setSize(2, samplesPerBlockExpected);
+    broadbandBusBuffer.setSize(ReverbTail::fdnOrder, samplesPerBlockExpected);
+    blockRamp.resize( samplesPerBlockExpected );
+    for( int i = 0; i < samplesPerBlockExpected; i++ ){ blockRamp[i] = (i + 1) / (float)samplesPerBlockExpected; }
     
     // keep local copies
     localSampleRate = sampleRate;
@@ -104,343 +271,1198 @@ void prepareToPlay( const unsigned int samplesPerBlockExpected, const double sam
     
     // init filter bank
     filterBank.prepareToPlay( samplesPerBlockExpected, sampleRate );
-    filterBank.setNumFilters( NUM_OCTAVE_BANDS, current->ids.size() );
+    setFilterBankSize( ( current->numBands > 0 ) ? current->numBands : NUM_OCTAVE_BANDS );
+    firDesigner.prepareToPlay( samplesPerBlockExpected, sampleRate );
     
     // init reverb tail
     reverbTail.prepareToPlay( samplesPerBlockExpected, sampleRate );
     tailBuffer.setSize(reverbTail.fdnOrder, samplesPerBlockExpected);
+    convolutionReverbTail.prepareToPlay( samplesPerBlockExpected, sampleRate );
     
     // init binaural encoder
     binauralEncoder.prepareToPlay( samplesPerBlockExpected, sampleRate );
-}
     
-// get max source image delay in seconds
-float getMaxDelayFuture()
+    // init ambisonic encoder
+    ambisonicMatrixEncoder.prepareToPlay( samplesPerBlockExpected, slots->size() );
+    
+    cpuBudget.prepareToPlay( samplesPerBlockExpected, sampleRate );
+}
+
+// get max source image delay in seconds (including start delays of ramping source images)
+float getMaxDelay()
 {
-    float maxDelayTap = getMaxValue(future->delays);
+    float maxDelayTap = 0.f;
+    for( int j = 0; j < current->ids.size(); j++ )
+    {
+        int s = current->slots[j];
+        maxDelayTap = fmax( maxDelayTap, fmax( current->delays[j], fmax( slots->delaysStart[s], slots->delaysEnd[s] ) ) );
+    }
     return maxDelayTap;
 }
     
 // main: loop over sources images, apply delay + room coloration + spatialization
 void getNextAudioBlock( DelayLine* delayLine, AudioBuffer<float> & ambisonicBuffer )
 {
-    
-    // update crossfade mechanism
-    updateCrossfade();
+    cpuBudget.startBlock();
     
     // clear output buffer (since used as cumulative buffer, iteratively summing sources images buffers)
     ambisonicBuffer.clear();
     
-    // loop over sources images
-    for( int j = 0; j < numSourceImages; j++ )
+    // make room for source images signals in ambisonic encoder
+    ambisonicMatrixEncoder.setNumSourceImages( numSourceImages );
+    
+    // loop over sources images, split between workers
+    blockDelayLine = delayLine;
+    blockAmbisonicBuffer = &ambisonicBuffer;
+    for( auto & context : processingContexts )
+    {
+        context.reverbBusBuffers.clear();
+        context.hasAmbisonicRamps = false;
+        context.hasBroadbandBus = false;
+    }
+    if( workerPool.getNumWorkers() > 1 ){ workerPool.run( ( numSourceImages + imagesPerChunk - 1 ) / imagesPerChunk ); }
+    else{ processSourceImages( 0, numSourceImages, processingContexts[0] ); }
+    
+    //==========================================================================
+    // FEED REVERB TAIL FDN
+    
+    // sum partial reverb buses (which thread processed which chunk depends on timing: with several workers, the
+    // summation order, hence the output rounding, varies from run to run)
+    if( feedsFdnReverbTail() )
+    {
+        for( auto & context : processingContexts ){ reverbTail.addBusBuffers( context.reverbBusBuffers ); }
+        addBroadbandBusToReverbTail();
+    }
+    
+    //==========================================================================
+    // AMBISONIC ENCODING
+    
+    // encode all source images at once with their gains at block start, then add the gains change over the
+    // block of ramping source images (see spatializeSourceImage)
+    ambisonicMatrixEncoder.encodeAndAddTo( ambisonicBuffer, 2, current->ambisonicGainsBlock.data() );
+    for( auto & context : processingContexts )
+    {
+        if( !context.hasAmbisonicRamps ){ continue; }
+        for( int k = 0; k < N_AMBI_CH; k++ ){ ambisonicBuffer.addFrom(2+k, 0, context.ambisonicRampBuffer, k, 0, localSamplesPerBlockExpected); }
+    }
+    
+    //==========================================================================
+    // ADD REVERB TAIL
+    
+    if( feedsFdnReverbTail() )
     {
+        // get tail buffer
+        reverbTail.extractBusToBuffer( tailBuffer );
         
-        //==========================================================================
-        // GET DELAYED BUFFER
-        float delayInFractionalSamples = 0.0;
-        if( !crossfadeOver ) // Add old and new tapped delayed buffers with gain crossfade
-        {
-            // get old delay, tap from delay line, apply gain=f(delay)
-            if( j < current->delays.size() )
-            {
-                delayInFractionalSamples = current->delays[j] * localSampleRate;
-                delayLine->fillBufferWithDelayedChunk( workingBuffer, 0, 0, 0, delayInFractionalSamples, localSamplesPerBlockExpected );
-                workingBuffer.applyGain(1.0 - crossfadeGain);
-            }
-            else{ workingBuffer.clear(); }
-            
-            // get new delay, tap from delay line, apply gain=f(delay)
-            if( j < future->delays.size() )
-            {
-                delayInFractionalSamples = future->delays[j] * localSampleRate;
-                delayLine->fillBufferWithDelayedChunk( workingBufferTemp, 0, 0, 0, delayInFractionalSamples, localSamplesPerBlockExpected );
-                workingBufferTemp.applyGain(crossfadeGain);
-            }
-            else{ workingBufferTemp.clear(); }
-            
-            // add both buffers
-            workingBuffer.addFrom(0, 0, workingBufferTemp, 0, 0, localSamplesPerBlockExpected);
-        }
-        else // simple update
+        // apply gain
+        tailBuffer.applyGain( reverbTailGain );
+        
+        // add to ambisonic channels
+        int ambiId; int fdnId;
+        for( int k = 0; k < fmin(N_AMBI_CH, reverbTail.fdnOrder); k++ )
         {
-            // get delay, tap from delay line
-            if( j < current->delays.size() )
-            {
-                delayInFractionalSamples = (current->delays[j] * localSampleRate);
-                delayLine->fillBufferWithDelayedChunk( workingBuffer, 0, 0, 0, delayInFractionalSamples, localSamplesPerBlockExpected );
-            }
+            ambiId = k % 4; // only add reverb tail to WXYZ
+            fdnId = k % reverbTail.fdnOrder;
+            ambisonicBuffer.addFrom(2+ambiId, 0, tailBuffer, fdnId, 0, localSamplesPerBlockExpected);
         }
-        
-        //==========================================================================
-        // APPLY GAIN BASED ON SOURCE IMAGE PATH LENGTH
-        float gainDelayLine = 0.0f;
-        if( !crossfadeOver )
+    }
+    
+    // measured room impulse response: convolve (non delayed) input
+    else if( enableReverbTail && convolutionReverbTail.isActive() )
+    {
+        processingContextStruct & context = processingContexts[0];
+        delayLine->fillBufferWithDelayedChunk( context.workingBuffer, 0, 0, 0, 0.0f, localSamplesPerBlockExpected );
+        convolutionReverbTail.processAndAddTo( context.workingBuffer.getReadPointer(0), ambisonicBuffer, 2, reverbTailGain );
+    }
+    
+    cpuBudget.endBlock();
+}
+
+// build scene from latest received OSC info and publish it to the audio thread (see applyPendingScene).
+// To be called from the message thread, after oscHandler.updateInternals: no audio thread state is touched here.
+// Only source images added or updated since last call are recomputed (all of them if source image map was
+// cleared, number of bands or coloration mode changed), and only their directivity / Ambisonic gains if source / listener moved.
+// Removed source images are kept (flagged) until the audio thread reports them faded out, so are clustered ones
+// (left out of scenes once faded out, see clusterSourceImages).
+void updateFromOscHandler( OSCHandler & oscHandler )
+{
+    eraseFadedOutSourceImages();
+    
+    sceneRevision++;
+    int numBands = numFreqBands;
+    bool useFirColoration = enableFirColoration;
+    bool colorationChanged = numBands != sceneNumBands || useFirColoration != sceneFirColoration;
+    bool updateAll = updateAllSourceImages || oscHandler.isSourceImageMapCleared() || colorationChanged;
+    updateAllSourceImages = false;
+    
+    // list source images to recompute, flag removed ones
+    std::vector<int> updatedIds;
+    if( updateAll )
+    {
+        // band values of removed source images no longer apply after a change of number of bands or coloration
+        // mode: erased right away
+        for( auto ent1 = sourceImages.begin(); ent1 != sourceImages.end(); )
         {
-            if( j < current->pathLengths.size() ){ gainDelayLine += (1.0 - crossfadeGain) * (1.0/current->pathLengths[j]); }
-            if( j < future->pathLengths.size() ){ gainDelayLine += crossfadeGain * (1.0/future->pathLengths[j]); }
+            if( oscHandler.hasSourceImage(ent1->first) || ( isCluster(ent1->first) && !colorationChanged ) ){ ent1++; }
+            else if( colorationChanged ){ ent1 = eraseSourceImage( ent1 ); }
+            else{ removeSourceImage( (ent1++)->second ); }
         }
-        else
+        updatedIds = oscHandler.getSourceImageIDs();
+    }
+    else
+    {
+        for( int sourceID : oscHandler.getUpdatedSourceImageIDs() )
         {
-            if( j < current->pathLengths.size() )
+            if( oscHandler.hasSourceImage(sourceID) ){ updatedIds.push_back(sourceID); }
+            else
             {
-                gainDelayLine = 1.0/current->pathLengths[j];
+                auto sourceImage = sourceImages.find(sourceID);
+                if( sourceImage != sourceImages.end() ){ removeSourceImage( sourceImage->second ); }
             }
         }
-        workingBuffer.applyGain( fmin( 1.0, fmax( 0.0, gainDelayLine )) );
+    }
+    sceneNumBands = numBands;
+    sceneFirColoration = useFirColoration;
+    
+    // update path length and absorption coefficients
+    Array<float> bandValues;
+    for( int sourceID : updatedIds )
+    {
+        sourceImageStruct & sourceImage = sourceImages[sourceID];
+        if( sourceImage.slot < 0 ){ sourceImage.slot = allocateSlot(); }
+        sourceImage.revision = sceneRevision;
+        sourceImage.removed = false;
+        sourceImage.reflectionOrder = oscHandler.getSourceImageReflectionOrder(sourceID);
+        sourceImage.pathLength = oscHandler.getSourceImagePathLength(sourceID);
         
-        //==========================================================================
-        // APPLY FREQUENCY SPECIFIC GAINS (ABSORPTION, DIRECTIVITY)
+        bandValues = oscHandler.getSourceImageAbsorption(sourceID);
+        if( numBands == 3 ){ bandValues = from10to3bands(bandValues); }
+        for( int k = 0; k < numBands; k++ ){ sourceImage.absorptionCoefs[k] = bandValues[k]; }
+    }
+    
+    // update directivity gains and Ambisonic gains: of all source images if source / listener moved
+    bool updateAllDirectivities = updateAll || oscHandler.hasSourceMoved();
+    bool updateAllDirections = updateAll || oscHandler.hasListenerMoved();
+    for( auto & ent1 : sourceImages )
+    {
+        sourceImageStruct & sourceImage = ent1.second;
+        if( sourceImage.removed || isCluster(ent1.first) ){ continue; }
+        bool isUpdated = sourceImage.revision == sceneRevision;
         
-        // decompose in frequency bands
-        filterBank.decomposeBuffer( workingBuffer, bandBuffer, j);
+        if( isUpdated || updateAllDirectivities )
+        {
+            Eigen::Vector3f dod = oscHandler.getSourceImageDOD(ent1.first);
+            bandValues = directivityHandler.getGains(dod(0), dod(1));
+            if( numBands == 3 ){ bandValues = from10to3bands(bandValues); }
+            for( int k = 0; k < numBands; k++ ){ sourceImage.directivityGains[k] = bandValues[k]; }
+        }
         
-        // apply absorption gains and recompose
-        workingBuffer.clear();
-        float absorptionCoef, dirGain;
-        for( int k = 0; k < bandBuffer.getNumChannels(); k++ )
+        // merge absorption and directivity gains into one gain per band, design its FIR
+        if( isUpdated || updateAllDirectivities )
         {
-            absorptionCoef = 0.f;
-            dirGain = 0.f;
-            
-            // apply crossfade
-            if( !crossfadeOver )
-            {
-                if( j < current->absorptionCoefs.size() )
-                {
-                    absorptionCoef += (1.0 - crossfadeGain) * current->absorptionCoefs[j][k];
-                    dirGain += (1.0 - crossfadeGain) * current->directivityGains[j][k];
-                }
-                if( j < future->absorptionCoefs.size() )
-                {
-                    absorptionCoef += crossfadeGain * future->absorptionCoefs[j][k];
-                    dirGain += crossfadeGain * future->directivityGains[j][k];
-                }
-            }
-            else
+            for( int k = 0; k < numBands; k++ ){ sourceImage.bandGains[k] = getBandGain( sourceImage.absorptionCoefs[k], sourceImage.directivityGains[k] ); }
+            if( useFirColoration )
             {
-                if( j < current->absorptionCoefs.size() )
-                {
-                    absorptionCoef = current->absorptionCoefs[j][k];
-                    dirGain = current->directivityGains[j][k]; // only using real part here
-                }
+                sourceImage.firSpectrum.resize( ColorationFIR::numBins );
+                firDesigner.design( sourceImage.bandGains.data(), numBands, sourceImage.firSpectrum.data() );
             }
-            
-            // bound gains
-            absorptionCoef = fmin( 1.0, fmax( 0.0,  1.f - absorptionCoef ));
-            dirGain = fmin( 1.0, fmax( 0.0, dirGain ));
-            
-            // apply absorption gains (TODO: sometimes crashes here at startup because absorptionCoefs data is null pointer)
-            bandBuffer.applyGain(k, 0, localSamplesPerBlockExpected, absorptionCoef);
-            
-            // apply directivity gain (TODO: merge with absorption gain above)
-            bandBuffer.applyGain(k, 0, localSamplesPerBlockExpected, dirGain);
-            
-            // recompose (add-up frequency bands)
-            workingBuffer.addFrom(0, 0, bandBuffer, k, 0, localSamplesPerBlockExpected);
         }
         
-        //==========================================================================
-        // FEED REVERB TAIL FDN
-        if( enableReverbTail )
+        if( isUpdated || updateAllDirections )
         {
-            int busId = j % reverbTail.fdnOrder;
-            reverbTail.addToBus(busId, bandBuffer);
+            Eigen::Vector3f doa = oscHandler.getSourceImageDOA(ent1.first);
+            sourceImage.azimuth = doa(0);
+            sourceImage.elevation = doa(1);
+            Array<float> channelValues = ambisonicEncoder.calcParams(doa(0), doa(1));
+            for( int k = 0; k < N_AMBI_CH; k++ ){ sourceImage.ambisonicGains[k] = channelValues[k]; }
         }
         
-        //==========================================================================
-        // APPLY DIRECT PATH / EARLY GAINS
-        if( j < current->ids.size() && directPathId == current->ids[j] )
-        {
-            workingBuffer.applyGain(directPathGain);
-        }
-        else
+        if( updateAllDirectivities || updateAllDirections ){ sourceImage.revision = sceneRevision; }
+    }
+    
+    // merge source images close in direction and delay into clusters
+    clusterSourceImages( numBands, useFirColoration );
+    
+    // fill scene (source images sorted by id, clusters first)
+    int numImages = 0;
+    for( auto const & ent1 : sourceImages ){ if( isInScene( ent1.second ) ){ numImages++; } }
+    SceneState* scene = new SceneState();
+    scene->resize( numImages, numBands, useFirColoration );
+    int j = 0;
+    for( auto const & ent1 : sourceImages )
+    {
+        const sourceImageStruct & sourceImage = ent1.second;
+        if( !isInScene( sourceImage ) ){ continue; }
+        scene->ids[j] = ent1.first;
+        scene->revisions[j] = sourceImage.revision;
+        scene->slots[j] = sourceImage.slot;
+        scene->pathLengths[j] = sourceImage.pathLength;
+        scene->delays[j] = sourceImage.pathLength / SOUND_SPEED;
+        std::copy( sourceImage.bandGains.begin(), sourceImage.bandGains.begin() + numBands, scene->bandGains.begin() + j*numBands );
+        if( useFirColoration ){ std::copy( sourceImage.firSpectrum.begin(), sourceImage.firSpectrum.end(), scene->firSpectra.begin() + j*ColorationFIR::numBins ); }
+        std::copy( sourceImage.ambisonicGains.begin(), sourceImage.ambisonicGains.end(), scene->ambisonicGains.begin() + j*N_AMBI_CH );
+        scene->reflectionOrders[j] = sourceImage.reflectionOrder;
+        scene->energies[j] = std::pow( getPathGain( sourceImage.pathLength ) * getBroadbandGain( sourceImage.bandGains.data(), numBands ), 2.f );
+        scene->removed[j] = sourceImage.removed || sourceImage.clustered;
+        if( scene->removed[j] ){ scene->numRemoved++; }
+        else{ scene->maxReflectionOrder = jmax( scene->maxReflectionOrder, sourceImage.reflectionOrder ); }
+        j++;
+    }
+    
+    // rank source images by predicted energy for culling: direct path first, removed ones last
+    std::vector<int> ranking( scene->ids.size() );
+    std::iota( ranking.begin(), ranking.end(), 0 );
+    std::sort( ranking.begin(), ranking.end(), [scene]( const int a, const int b )
+    {
+        return std::make_tuple( scene->removed[a], scene->reflectionOrders[a] != 0, -scene->energies[a], a )
+             < std::make_tuple( scene->removed[b], scene->reflectionOrders[b] != 0, -scene->energies[b], b );
+    });
+    for( int rank = 0; rank < ranking.size(); rank++ ){ scene->energyRanks[ ranking[rank] ] = rank; }
+    
+    // audio thread slot storage too small: grown one allocated here, swapped in by applyPendingScene (along with
+    // Ambisonic encoder signals, scenes have at most one source image per slot)
+    scene->numSlots = numSlots;
+    int capacity = slotCapacity.load( std::memory_order_acquire );
+    if( numSlots > capacity )
+    {
+        int grownCapacity = jmax( numSlots, 2 * capacity, 64 );
+        scene->grownSlots.reset( new SourceImageSlots() );
+        scene->grownSlots->resize( grownCapacity );
+        scene->grownSourceSignals.reset( AmbisonicMatrixEncoder::allocateSourceSignals( grownCapacity, localSamplesPerBlockExpected ) );
+    }
+    
+    // reverb tail RT60 (even if not enabled, not cpu demanding and that way it's ready to use)
+    scene->valuesRT60 = from10to3bands( oscHandler.getRT60Values() );
+    
+    // direct path direction of arrival, for binaural encoder
+    scene->directPathId = oscHandler.getDirectPathId();
+    auto directPath = sourceImages.find( scene->directPathId );
+    if( directPath != sourceImages.end() )
+    {
+        scene->directPathAzimuth = directPath->second.azimuth;
+        scene->directPathElevation = directPath->second.elevation;
+    }
+    
+    // hand over to the audio thread
+    sceneExchange.publish( scene );
+}
+
+// recompute all source images at next updateFromOscHandler (e.g. after directivity change), message thread only
+void invalidateSourceImages()
+{
+    updateAllSourceImages = true;
+}
+
+// acquire latest scene published by updateFromOscHandler if any, to be called at the beginning of each audio block,
+// audio thread only. A new scene is applied right away: source images added, removed or modified by the update ramp
+// from their current (possibly mid-ramp) parameters, the others keep their state. Returns true if a new scene was acquired.
+bool applyPendingScene()
+{
+    // CPU budget reduction / increase of the level of detail, if any
+    int lodAdjustment = cpuBudget.getAdjustment();
+    
+    SceneState* scene = sceneExchange.acquire();
+    if( scene != nullptr )
+    {
+        // swap in grown slot storage / encoder signals if any, replaced ones are deleted along with the scene (off the
+        // audio thread). Encoder signals allocated before a block size change are not: grown again at next update.
+        if( scene->grownSlots != nullptr && scene->grownSlots->size() > slots->size() )
         {
-            workingBuffer.applyGain(earlyGain);
+            scene->grownSlots->copyFrom( *slots );
+            std::swap( slots, scene->grownSlots );
         }
+        if( scene->grownSourceSignals != nullptr ){ ambisonicMatrixEncoder.swapSourceSignals( *scene->grownSourceSignals ); }
+        slotCapacity.store( jmin( slots->size(), ambisonicMatrixEncoder.getCapacity() ), std::memory_order_release );
+        jassert( scene->numSlots <= slots->size() );
         
-        //==========================================================================
-        // BINAURAL ENCODING (DIRECT PATH ONLY)
-        if( enableDirectToBinaural && j < current->ids.size() && directPathId == current->ids[j] )
-        {
-            // apply filter
-            binauralEncoder.encodeBuffer(workingBuffer, binauralBuffer);
-            
-            // manual loudness normalization (todo: handle this during hrir filter creation)
-            binauralBuffer.applyGain(3.7f);
-            
-            // add to output
-            ambisonicBuffer.copyFrom(0, 0, binauralBuffer, 0, 0, localSamplesPerBlockExpected);
-            ambisonicBuffer.copyFrom(1, 0, binauralBuffer, 1, 0, localSamplesPerBlockExpected);
-            
-            // skip remaining (ambisonic encoding)
-            continue;
-        }
+        // replaced scene is deleted off the audio thread
+        bool firColorationChanged = scene->useFirColoration != current->useFirColoration;
+        sceneExchange.retire( current );
+        current = scene;
+        
+        // update filter bank size (resets filter states)
+        bool numBandsChanged = current->numBands != filterBank.numOctaveBands;
+        if( numBandsChanged ){ setFilterBankSize( current->numBands ); }
         
-        //==========================================================================
-        // AMBISONIC ENCODING
+        // filter / FIR state left by the other coloration mode no longer applies
+        if( firColorationChanged ){ std::fill( slots->colorationBypassed.begin(), slots->colorationBypassed.end(), 1 ); }
         
-        // keep local copy since working buffer will be used to store ambisonic buffers
-        clipboardBuffer = workingBuffer;
+        // start ramps of source images added, removed or modified by the update (or whose level of detail changed)
+        updateLevelOfDetail( lodAdjustment );
+        matchSourceImages( numBandsChanged || firColorationChanged );
+        
+        // update reverb tail
+        reverbTail.setRT60Values( current->valuesRT60 );
+        
+        if( current->directPathId > -1 ){ directPathPositionPending = true; }
+    }
+    
+    // level of detail changed by the CPU budget or by the policy: ramp source images to their new one
+    else if( lodAdjustment != 0 || levelOfDetailPolicy != lodPolicy || feedsFdnReverbTail() != lodReverbTail )
+    {
+        if( updateLevelOfDetail( lodAdjustment ) ){ retargetLevelsOfDetail(); }
+    }
+    
+    // update binaural encoder (even if not enabled, not cpu demanding and that way it's ready to use) once done
+    // with its crossfade towards previous position: restarting it at each update would stall on the old position
+    if( directPathPositionPending && binauralEncoder.isCrossfadeOver() )
+    {
+        binauralEncoder.setPosition( current->directPathAzimuth, current->directPathElevation );
+        directPathPositionPending = false;
+    }
+    
+    // no source image left to process once removed ones are faded out (make sure MainComponent continues to play
+    // unprocessed input)
+    int numFadedOut = notifyFadedOutSourceImages();
+    numSourceImages = ( numFadedOut == current->ids.size() ) ? 0 : current->ids.size();
+    numSourceImages = jmin( numSourceImages, ambisonicMatrixEncoder.getCapacity() ); // until encoder signals are grown
+    
+    return scene != nullptr;
+}
+
+// set number of filter bank bands, audio thread only (or while not processing)
+void setFilterBankSize( const unsigned int numBands )
+{
+    filterBank.setNumBands( numBands );
+    
+    // filter states of previous bands no longer apply
+    for( auto & filterState : slots->filterStates ){ filterState.reset(); }
+    for( auto & filterState : broadbandBusFilterStates ){ filterState.reset(); }
+    
+    // band buffers are allocated for NUM_OCTAVE_BANDS in prepareToPlay: no re-allocation here
+    for( auto & context : processingContexts )
+    {
+        for( auto & bandBuffer : context.bandBuffers ){ bandBuffer.setSize( numBands, localSamplesPerBlockExpected, false, false, true ); }
+    }
+}
+    
+private:
+
+// FDN reverb tail is used unless a measured room impulse response is loaded
+bool feedsFdnReverbTail() const
+{
+    return enableReverbTail && !convolutionReverbTail.isActive();
+}
+
+// flag source image as removed (faded out by the audio thread), message thread only
+void removeSourceImage( sourceImageStruct & sourceImage )
+{
+    if( sourceImage.removed ){ return; }
+    sourceImage.removed = true;
+    sourceImage.revision = sceneRevision;
+}
+
+// give a processing slot to a new source image (O(1)), message thread only
+int allocateSlot()
+{
+    if( freeSlots.empty() ){ return numSlots++; }
+    int slot = freeSlots.back();
+    freeSlots.pop_back();
+    return slot;
+}
+
+// erase source image, its slot is free for reuse, message thread only
+std::map<int, sourceImageStruct>::iterator eraseSourceImage( std::map<int, sourceImageStruct>::iterator sourceImage )
+{
+    if( sourceImage->second.slot >= 0 ){ freeSlots.push_back( sourceImage->second.slot ); }
+    if( isCluster( sourceImage->first ) ){ clusterIds.erase( sourceImage->second.clusterKey ); }
+    return sourceImages.erase( sourceImage );
+}
+
+// true for ids of clusters (see clusterSourceImages)
+static bool isCluster( const int sourceID )
+{
+    return sourceID < -1;
+}
+
+// false for clustered source images done fading out: rendered through their cluster
+static bool isInScene( const sourceImageStruct & sourceImage )
+{
+    return !sourceImage.clustered || !sourceImage.clusteredFadedOut || sourceImage.removed;
+}
+
+// Merge source images of reflection order minClusteredOrder and above into clusters, one per grid cell of
+// direction of arrival and delay (see getClusterKey) holding several of them, message thread only. A cluster is
+// rendered as a source image: a single delay tap, filter bank / FIR and Ambisonic encoding for all the source
+// images of the cell, which are faded out. Its parameters are their energy weighted mean (path length, direction)
+// and the sum of their band energies (band gains), its reflection order the lowest of theirs. Clusters of cells
+// left with a single source image are removed, this source image fades back in.
+void clusterSourceImages( const int numBands, const bool useFirColoration )
+{
+    // group source images by grid cell
+    std::map<std::tuple<int, int, int>, std::vector<int>> cells;
+    bool isClustering = enableClustering && clusterAngle > 0.f && clusterDelay > 0.f;
+    for( auto const & ent1 : sourceImages )
+    {
+        if( isClustering && isClusterable( ent1.first, ent1.second ) ){ cells[ getClusterKey( ent1.second ) ].push_back( ent1.first ); }
+    }
+    
+    // source images alone in their cell are rendered as such
+    for( auto & ent1 : sourceImages )
+    {
+        sourceImageStruct & sourceImage = ent1.second;
+        if( isCluster(ent1.first) || sourceImage.removed ){ continue; }
+        bool isClustered = isClustering && isClusterable( ent1.first, sourceImage ) && cells[ getClusterKey( sourceImage ) ].size() > 1;
+        if( isClustered == sourceImage.clustered ){ continue; }
+        sourceImage.clustered = isClustered;
+        sourceImage.clusteredFadedOut = false;
+        sourceImage.revision = sceneRevision;
+    }
+    
+    // update clusters of cells holding several source images (new parameters ramped to by the audio thread)
+    for( auto const & cell : cells )
+    {
+        if( cell.second.size() < 2 ){ continue; }
+        auto clusterId = clusterIds.find( cell.first );
+        if( clusterId == clusterIds.end() ){ clusterId = clusterIds.emplace( cell.first, nextClusterId-- ).first; }
         
-        for( int k = 0; k < N_AMBI_CH; k++ )
+        sourceImageStruct & cluster = sourceImages[ clusterId->second ];
+        cluster.clusterKey = cell.first;
+        if( cluster.slot < 0 ){ cluster.slot = allocateSlot(); }
+        if( mergeSourceImages( cell.second, numBands, useFirColoration, cluster ) || cluster.removed )
         {
-            // create working copy
-            workingBuffer = clipboardBuffer;
-            
-            if( !crossfadeOver )
-            {
-                // create 2nd working copy
-                workingBufferTemp = clipboardBuffer;
-                
-                // apply ambisonic gain past
-                if( j < current->ambisonicGains.size() )
-                {
-                    workingBuffer.applyGain( (1.0 - crossfadeGain) * current->ambisonicGains[j][k] );
-                }
-                
-                // apply ambisonic gain future
-                if( j < future->ambisonicGains.size() )
-                {
-                    workingBufferTemp.applyGain( crossfadeGain * future->ambisonicGains[j][k] );
-                }
-                
-                // add past / future buffers
-                workingBuffer.addFrom(0, 0, workingBufferTemp, 0, 0, localSamplesPerBlockExpected);
-            }
-            else
-            {
-                // apply ambisonic gain
-                if( j < current->ambisonicGains.size() )
-                {
-                    workingBuffer.applyGain( current->ambisonicGains[j][k] );
-                }
-            }
-            
-            // iteratively fill in general ambisonic buffer with source image buffers (cumulative)
-            ambisonicBuffer.addFrom(2+k, 0, workingBuffer, 0, 0, localSamplesPerBlockExpected);
+            cluster.removed = false;
+            cluster.revision = sceneRevision;
         }
     }
     
-    //==========================================================================
-    // ADD REVERB TAIL
+    // remove the others
+    for( auto const & clusterId : clusterIds )
+    {
+        auto cell = cells.find( clusterId.first );
+        if( cell == cells.end() || cell->second.size() < 2 ){ removeSourceImage( sourceImages[ clusterId.second ] ); }
+    }
+}
+
+// true if source image is to be merged with others of its grid cell
+bool isClusterable( const int sourceID, const sourceImageStruct & sourceImage ) const
+{
+    return !isCluster( sourceID ) && !sourceImage.removed && sourceImage.reflectionOrder >= jmax( 1, minClusteredOrder );
+}
+
+// grid cell of a source image: azimuth, elevation (clusterAngle steps) and delay (clusterDelay steps). Azimuth is
+// wrapped to [0, 2pi[ (no cell boundary at +-pi), the last cell merged with the first one if 360 is not a multiple
+// of clusterAngle (no cell shorter than the others).
+std::tuple<int, int, int> getClusterKey( const sourceImageStruct & sourceImage ) const
+{
+    double angleStep = clusterAngle * M_PI / 180.0;
+    double azimuth = std::fmod( (double)sourceImage.azimuth, 2.0 * M_PI );
+    if( azimuth < 0.0 ){ azimuth += 2.0 * M_PI; }
+    int numAzimuthCells = jmax( 1, (int)std::floor( 360.0 / clusterAngle + 1e-6 ) );
+    int azimuthCell = (int)std::floor( azimuth / angleStep );
+    if( azimuthCell >= numAzimuthCells ){ azimuthCell = 0; }
+    return std::make_tuple( azimuthCell, (int)std::floor( sourceImage.elevation / angleStep ),
+                            (int)std::floor( sourceImage.pathLength / SOUND_SPEED / clusterDelay ) );
+}
+
+// set cluster parameters from the source images of sourceIDs (see clusterSourceImages), returns true if they changed
+bool mergeSourceImages( const std::vector<int> & sourceIDs, const int numBands, const bool useFirColoration, sourceImageStruct & cluster )
+{
+    // band energies (path length gain included) summed, path length and direction weighted by mean band energy
+    std::array<float, NUM_OCTAVE_BANDS> bandEnergies {{}};
+    float energySum = 0.f;
+    float pathLength = 0.f;
+    Eigen::Vector3f direction = Eigen::Vector3f::Zero();
+    int reflectionOrder = std::numeric_limits<int>::max();
+    for( int sourceID : sourceIDs )
+    {
+        const sourceImageStruct & sourceImage = sourceImages[sourceID];
+        float pathGain = getPathGain( sourceImage.pathLength );
+        float energy = 1e-20f; // equal weights if all silent
+        for( int k = 0; k < numBands; k++ )
+        {
+            float bandEnergy = std::pow( pathGain * sourceImage.bandGains[k], 2.f );
+            bandEnergies[k] += bandEnergy;
+            energy += bandEnergy / numBands;
+        }
+        energySum += energy;
+        pathLength += energy * sourceImage.pathLength;
+        direction += energy * Eigen::Vector3f( std::cos( sourceImage.elevation ) * std::sin( sourceImage.azimuth ), std::cos( sourceImage.elevation ) * std::cos( sourceImage.azimuth ), std::sin( sourceImage.elevation ) );
+        reflectionOrder = jmin( reflectionOrder, sourceImage.reflectionOrder );
+    }
+    pathLength /= energySum;
+    Eigen::Vector3f doa = cartesianToSpherical( direction );
+    
+    std::array<float, NUM_OCTAVE_BANDS> bandGains;
+    for( int k = 0; k < numBands; k++ ){ bandGains[k] = std::sqrt( bandEnergies[k] ) / getPathGain( pathLength ); }
+    
+    bool isChanged = pathLength != cluster.pathLength || doa(0) != cluster.azimuth || doa(1) != cluster.elevation
+        || reflectionOrder != cluster.reflectionOrder || !std::equal( bandGains.begin(), bandGains.begin() + numBands, cluster.bandGains.begin() );
+    if( !isChanged ){ return false; }
     
-    if( enableReverbTail )
+    cluster.pathLength = pathLength;
+    cluster.azimuth = doa(0);
+    cluster.elevation = doa(1);
+    cluster.reflectionOrder = reflectionOrder;
+    cluster.bandGains = bandGains;
+    if( useFirColoration )
     {
-        // get tail buffer
-        reverbTail.extractBusToBuffer( tailBuffer );
+        cluster.firSpectrum.resize( ColorationFIR::numBins );
+        firDesigner.design( cluster.bandGains.data(), numBands, cluster.firSpectrum.data() );
+    }
+    Array<float> channelValues = ambisonicEncoder.calcParams( cluster.azimuth, cluster.elevation );
+    for( int k = 0; k < N_AMBI_CH; k++ ){ cluster.ambisonicGains[k] = channelValues[k]; }
+    return true;
+}
+
+// erase removed source images reported faded out by the audio thread (unless re-added since), message thread only.
+// Clustered ones are left out of next scenes.
+void eraseFadedOutSourceImages()
+{
+    int start1, size1, start2, size2;
+    fadedOutFifo.prepareToRead( fadedOutFifo.getNumReady(), start1, size1, start2, size2 );
+    for( int i = 0; i < size1 + size2; i++ )
+    {
+        const std::pair<int, int> & fadedOut = fadedOutSourceImages[ ( i < size1 ) ? start1 + i : start2 + i - size1 ];
+        auto sourceImage = sourceImages.find( fadedOut.first );
+        if( sourceImage == sourceImages.end() || sourceImage->second.revision != fadedOut.second ){ continue; }
+        if( sourceImage->second.removed ){ eraseSourceImage( sourceImage ); }
+        else if( sourceImage->second.clustered ){ sourceImage->second.clusteredFadedOut = true; }
+    }
+    fadedOutFifo.finishedRead( size1 + size2 );
+}
+
+// report removed source images done fading out to the message thread (once each, left for next block if the fifo
+// is full), audio thread only. Returns number of removed source images done fading out.
+int notifyFadedOutSourceImages()
+{
+    if( current->numRemoved == 0 ){ return 0; }
+    
+    int numFadedOut = 0;
+    for( int j = 0; j < current->ids.size(); j++ )
+    {
+        int s = current->slots[j];
+        if( !current->removed[j] || slots->rampPositions[s] < 1.f ){ continue; }
+        numFadedOut++;
+        if( slots->removalNotified[s] || fadedOutFifo.getFreeSpace() == 0 ){ continue; }
         
-        // apply gain
-        tailBuffer.applyGain( reverbTailGain );
+        int start1, size1, start2, size2;
+        fadedOutFifo.prepareToWrite( 1, start1, size1, start2, size2 );
+        fadedOutSourceImages[start1] = std::make_pair( current->ids[j], current->revisions[j] );
+        fadedOutFifo.finishedWrite( 1 );
+        slots->removalNotified[s] = 1;
+    }
+    return numFadedOut;
+}
+
+// carry over audio thread state of source images of the newly acquired scene, kept in their slot: unchanged
+// source images keep their ramp, modified ones (or whose level of detail changed) ramp from their current
+// parameters, added ones (or re-added after fading out) fade in. Band gains (and FIRs) start from their target
+// after a change of number of bands or coloration mode.
+void matchSourceImages( const bool colorationChanged )
+{
+    const SceneState & scene = *current;
+    SourceImageSlots & state = *slots;
+    for( int j = 0; j < scene.ids.size(); j++ )
+    {
+        int s = scene.slots[j];
+        bool isModified = state.revisions[s] != scene.revisions[j];
+        bool isFadedOut = state.levelsTarget[s] == 0.f && state.rampPositions[s] >= 1.f;
+        LevelOfDetail levelOfDetail = getLevelOfDetail(j);
+        bool levelOfDetailChanged = levelOfDetail != state.levelsOfDetail[s] && !scene.removed[j];
+        state.levelsOfDetail[s] = levelOfDetail;
         
-        // add to ambisonic channels
-        int ambiId; int fdnId;
-        for( int k = 0; k < fmin(N_AMBI_CH, reverbTail.fdnOrder); k++ )
-        {
-            ambiId = k % 4; // only add reverb tail to WXYZ
-            fdnId = k % reverbTail.fdnOrder;
-            ambisonicBuffer.addFrom(2+ambiId, 0, tailBuffer, fdnId, 0, localSamplesPerBlockExpected);
-        }
+        if( state.ids[s] != scene.ids[j] || ( isModified && isFadedOut ) ){ startFadeIn( j, s ); }
+        else if( isModified || colorationChanged || levelOfDetailChanged ){ startRamp( j, s, colorationChanged ); }
     }
+}
 
+// update level of detail limits (see getLevelOfDetail) from policy, current scene and CPU budget adjustment,
+// audio thread only. Returns true if they changed.
+bool updateLevelOfDetail( const int adjustment )
+{
+    bool reverbTailChanged = feedsFdnReverbTail() != lodReverbTail;
+    lodPolicy = levelOfDetailPolicy;
+    lodReverbTail = feedsFdnReverbTail();
+    
+    // CPU budget steps lower the full detail order first, then the encoded one, down to 1st order reflections
+    int maxEncodedOrder = jmin( lodPolicy.maxEncodedOrder, current->maxReflectionOrder );
+    int maxFullDetailOrder = jmin( lodPolicy.maxFullDetailOrder, maxEncodedOrder );
+    int fullDetailSteps = jmax( 0, maxFullDetailOrder - 1 );
+    int maxSteps = fullDetailSteps + jmax( 0, maxEncodedOrder - 1 );
+    
+    // past the last step (or right away if far over budget) the quietest source images are culled, by the ratio
+    // of budget to load (processing time follows the number of source images). They come back first.
+    int numImages = current->ids.size() - current->numRemoved;
+    float load = cpuBudget.getLoad();
+    if( adjustment > 0 && ( lodSteps >= maxSteps || load > 2.f * cpuBudget.targetLoad ) )
+    {
+        float ratio = jlimit( 0.5f, 0.9f, cpuBudget.targetLoad / load );
+        lodCullingLimit = jmax( 1, (int)( jmin( lodCullingLimit, numImages ) * ratio ) );
+    }
+    else if( adjustment < 0 && lodCullingLimit < numImages ){ lodCullingLimit += jmax( 1, lodCullingLimit / 8 ); }
+    else
+    {
+        if( adjustment < 0 ){ lodCullingLimit = std::numeric_limits<int>::max(); }
+        lodSteps = jlimit( 0, maxSteps, lodSteps + adjustment );
+    }
+    lodSteps = jmin( lodSteps, maxSteps );
+    maxFullDetailOrder -= jmin( lodSteps, fullDetailSteps );
+    maxEncodedOrder -= lodSteps - jmin( lodSteps, fullDetailSteps );
+    
+    float fullDetailEnergy = std::pow( 10.f, lodPolicy.fullDetailThreshold / 10.f );
+    float encodedEnergy = std::pow( 10.f, lodPolicy.encodedThreshold / 10.f );
+    int maxRenderedImages = jmin( lodPolicy.maxRenderedImages, lodCullingLimit );
+    bool isChanged = reverbTailChanged || maxFullDetailOrder != lodMaxFullDetailOrder || maxEncodedOrder != lodMaxEncodedOrder
+        || fullDetailEnergy != lodFullDetailEnergy || encodedEnergy != lodEncodedEnergy || maxRenderedImages != lodMaxRenderedImages;
+    lodMaxFullDetailOrder = maxFullDetailOrder;
+    lodMaxEncodedOrder = maxEncodedOrder;
+    lodFullDetailEnergy = fullDetailEnergy;
+    lodEncodedEnergy = encodedEnergy;
+    lodMaxRenderedImages = maxRenderedImages;
+    return isChanged;
 }
+
+// level of detail of source image j of current scene, from its reflection order and predicted energy (see
+// updateLevelOfDetail). Source images are only fed to the reverb tail if there is one.
+LevelOfDetail getLevelOfDetail( const int j ) const
+{
+    const SceneState & scene = *current;
+    int order = scene.reflectionOrders[j];
+    if( order == 0 ){ return LevelOfDetail::Full; }
+    if( scene.energyRanks[j] >= lodMaxRenderedImages ){ return LevelOfDetail::Culled; }
     
-// update local attributes based on latest received OSC info
-void updateFromOscHandler( OSCHandler & oscHandler )
+    float energy = scene.energies[j];
+    if( lodReverbTail && ( order > lodMaxEncodedOrder || energy < lodEncodedEnergy ) ){ return LevelOfDetail::ReverbTailOnly; }
+    if( order > lodMaxFullDetailOrder || energy < lodFullDetailEnergy ){ return LevelOfDetail::Broadband; }
+    return LevelOfDetail::Full;
+}
+
+// ramp source images of current scene whose level of detail changed to their new one, audio thread only
+void retargetLevelsOfDetail()
+{
+    const SceneState & scene = *current;
+    SourceImageSlots & state = *slots;
+    for( int j = 0; j < scene.ids.size(); j++ )
+    {
+        int s = scene.slots[j];
+        LevelOfDetail levelOfDetail = getLevelOfDetail(j);
+        if( scene.removed[j] || levelOfDetail == state.levelsOfDetail[s] ){ continue; }
+        state.levelsOfDetail[s] = levelOfDetail;
+        startRamp( j, s, false );
+    }
+}
+
+// source image j of current scene modified: ramp from the parameters reached so far in its slot s.
+// Delay taps are retargeted by delaySourceImage.
+void startRamp( const int j, const int s, const bool colorationChanged )
 {
-    // method should not be called while crossfade active.
-    // called by MainContentComponent::updateOnOscReveive that checks if crossfadeOver == true.
-    // should not need: if( !crossfadeOver ){ return; }
+    const SceneState & scene = *current;
+    SourceImageSlots & state = *slots;
+    float ramp = state.rampPositions[s];
+    
+    state.revisions[s] = scene.revisions[j];
+    state.rampPositions[s] = 0.f;
+    state.levelsStart[s] = getRampValue( state.levelsStart[s], state.levelsTarget[s], ramp );
+    state.levelsTarget[s] = isSilent( j, s ) ? 0.f : 1.f;
+    
+    // silent so far (culled or faded out): delay taps jump to their target rather than ramping from a stale delay
+    if( state.levelsStart[s] == 0.f ){ resetDelayTaps( j, s ); }
+    
+    // culled source images fade out with the band / Ambisonic gains reached so far (unless no longer valid)
+    bool keepsGains = state.levelsOfDetail[s] == LevelOfDetail::Culled && !colorationChanged;
     
-    future->ids = oscHandler.getSourceImageIDs();
-    future->delays = oscHandler.getSourceImageDelays();
-    future->pathLengths = oscHandler.getSourceImagePathsLength();
-    directPathId = oscHandler.getDirectPathId();
+    float* bandGainsStart = &state.bandGainsStart[s*NUM_OCTAVE_BANDS];
+    float* bandGainsTarget = &state.bandGainsTarget[s*NUM_OCTAVE_BANDS];
+    for( int k = 0; k < scene.numBands; k++ ){ bandGainsStart[k] = getRampValue( bandGainsStart[k], bandGainsTarget[k], ramp ); }
+    if( keepsGains ){ std::copy_n( bandGainsStart, scene.numBands, bandGainsTarget ); }
+    else{ getTargetBandGains( j, state.levelsOfDetail[s], bandGainsTarget ); }
+    if( colorationChanged ){ std::copy_n( bandGainsTarget, scene.numBands, bandGainsStart ); }
     
-    // update absorption coefficients
-    future->absorptionCoefs.resize(future->ids.size());
-    for (int j = 0; j < future->ids.size(); j++)
+    if( scene.useFirColoration )
     {
-        future->absorptionCoefs[j] = oscHandler.getSourceImageAbsorption(future->ids[j]);
-        if( filterBank.numOctaveBands == 3 )
-        {
-            future->absorptionCoefs[j] = from10to3bands(future->absorptionCoefs[j]);
-        }
+        std::complex<float>* firSpectrumStart = &state.firSpectraStart[s*ColorationFIR::numBins];
+        std::complex<float>* firSpectrumTarget = &state.firSpectraTarget[s*ColorationFIR::numBins];
+        for( int i = 0; i < ColorationFIR::numBins; i++ ){ firSpectrumStart[i] += ramp * ( firSpectrumTarget[i] - firSpectrumStart[i] ); }
+        if( keepsGains ){ std::copy_n( firSpectrumStart, ColorationFIR::numBins, firSpectrumTarget ); }
+        else{ getTargetFirSpectrum( j, state.levelsOfDetail[s], firSpectrumTarget ); }
+        if( colorationChanged ){ std::copy_n( firSpectrumTarget, ColorationFIR::numBins, firSpectrumStart ); }
     }
     
-    // update directivity gains
-    auto sourceImageDODs = oscHandler.getSourceImageDODs();
+    float* ambisonicGainsStart = &state.ambisonicGainsStart[s*N_AMBI_CH];
+    float* ambisonicGainsTarget = &state.ambisonicGainsTarget[s*N_AMBI_CH];
+    for( int k = 0; k < N_AMBI_CH; k++ ){ ambisonicGainsStart[k] = getRampValue( ambisonicGainsStart[k], ambisonicGainsTarget[k], ramp ); }
+    if( keepsGains ){ std::copy_n( ambisonicGainsStart, N_AMBI_CH, ambisonicGainsTarget ); }
+    else{ getTargetAmbisonicGains( j, state.levelsOfDetail[s], ambisonicGainsTarget ); }
+    state.removalNotified[s] = 0;
+    
+    // silent and staying so: nothing to ramp
+    if( state.levelsStart[s] == 0.f && state.levelsTarget[s] == 0.f ){ state.rampPositions[s] = 1.f; }
+}
+
+// source image j of current scene added in slot s: fade in with its target parameters, from cleared state
+void startFadeIn( const int j, const int s )
+{
+    const SceneState & scene = *current;
+    SourceImageSlots & state = *slots;
+    
+    state.ids[s] = scene.ids[j];
+    state.revisions[s] = scene.revisions[j];
+    state.rampPositions[s] = isSilent( j, s ) ? 1.f : 0.f; // removed / culled before ever being processed: nothing to fade out
+    state.levelsStart[s] = 0.f;
+    state.levelsTarget[s] = isSilent( j, s ) ? 0.f : 1.f;
+    getTargetBandGains( j, state.levelsOfDetail[s], &state.bandGainsTarget[s*NUM_OCTAVE_BANDS] );
+    std::copy_n( state.bandGainsTarget.begin() + s*NUM_OCTAVE_BANDS, scene.numBands, state.bandGainsStart.begin() + s*NUM_OCTAVE_BANDS );
+    if( scene.useFirColoration )
+    {
+        getTargetFirSpectrum( j, state.levelsOfDetail[s], &state.firSpectraTarget[s*ColorationFIR::numBins] );
+        std::copy_n( state.firSpectraTarget.begin() + s*ColorationFIR::numBins, ColorationFIR::numBins, state.firSpectraStart.begin() + s*ColorationFIR::numBins );
+    }
+    getTargetAmbisonicGains( j, state.levelsOfDetail[s], &state.ambisonicGainsTarget[s*N_AMBI_CH] );
+    std::copy_n( state.ambisonicGainsTarget.begin() + s*N_AMBI_CH, N_AMBI_CH, state.ambisonicGainsStart.begin() + s*N_AMBI_CH );
+    state.removalNotified[s] = 0;
+    resetDelayTaps( j, s );
     
-    future->directivityGains.resize(future->ids.size());
-    for (int j = 0; j < future->ids.size(); j++)
+    // filter / FIR state of the slot's previous source image, if any
+    state.colorationBypassed[s] = 1;
+}
+
+// single delay tap of source image j of current scene in slot s set to its target, from cleared read state
+void resetDelayTaps( const int j, const int s )
+{
+    SourceImageSlots & state = *slots;
+    state.delayRampPositions[s] = 1.f;
+    state.delaysStart[s] = current->delays[j];
+    state.delaysEnd[s] = current->delays[j];
+    state.gainsStart[s] = getPathGain( current->pathLengths[j] );
+    state.gainsEnd[s] = state.gainsStart[s];
+    state.delayAllpassStatesStart[s] = 0.f;
+    state.delayAllpassStates[s] = 0.f;
+}
+
+// true if source image j of current scene in slot s is to be faded out (removed or culled)
+bool isSilent( const int j, const int s ) const
+{
+    return current->removed[j] || slots->levelsOfDetail[s] == LevelOfDetail::Culled;
+}
+
+// target band gains (scene.numBands values) of source image j of current scene at a given level of detail
+void getTargetBandGains( const int j, const LevelOfDetail levelOfDetail, float* bandGains ) const
+{
+    const float* sceneBandGains = &current->bandGains[j*current->numBands];
+    if( levelOfDetail == LevelOfDetail::Full || levelOfDetail == LevelOfDetail::Culled ){ std::copy_n( sceneBandGains, current->numBands, bandGains ); }
+    else{ std::fill_n( bandGains, current->numBands, getBroadbandGain( sceneBandGains, current->numBands ) ); }
+}
+
+// target FIR spectrum of source image j of current scene at a given level of detail (FIR coloration only)
+void getTargetFirSpectrum( const int j, const LevelOfDetail levelOfDetail, std::complex<float>* firSpectrum ) const
+{
+    if( levelOfDetail == LevelOfDetail::Full || levelOfDetail == LevelOfDetail::Culled ){ std::copy_n( current->firSpectra.begin() + j*ColorationFIR::numBins, ColorationFIR::numBins, firSpectrum ); }
+    else{ std::fill_n( firSpectrum, ColorationFIR::numBins, ColorationFIR::getFlatSpectrum( getBroadbandGain( &current->bandGains[j*current->numBands], current->numBands ) ) ); }
+}
+
+// target Ambisonic gains of source image j of current scene at a given level of detail
+void getTargetAmbisonicGains( const int j, const LevelOfDetail levelOfDetail, float* ambisonicGains ) const
+{
+    if( levelOfDetail == LevelOfDetail::ReverbTailOnly ){ std::fill_n( ambisonicGains, N_AMBI_CH, 0.f ); }
+    else{ std::copy_n( current->ambisonicGains.begin() + j*N_AMBI_CH, N_AMBI_CH, ambisonicGains ); }
+}
+
+// value at a given ramp position, from start (0) to target (1)
+static float getRampValue( const float start, const float target, const float position )
+{
+    return start + position * ( target - start );
+}
+
+// gain based on source image path length
+static float getPathGain( const float pathLength )
+{
+    return fmin( 1.0, fmax( 0.0, 1.0/pathLength ));
+}
+
+// gain of a frequency band (absorption * directivity, bounded)
+static float getBandGain( const float absorptionCoef, const float dirGain )
+{
+    // only using real part of directivity gain here
+    return fmin( 1.0, fmax( 0.0,  1.f - absorptionCoef )) * fmin( 1.0, fmax( 0.0, dirGain ));
+}
+
+// single gain of the same energy as numBands band gains (root mean square)
+static float getBroadbandGain( const float* bandGains, const int numBands )
+{
+    float energy = 0.f;
+    for( int k = 0; k < numBands; k++ ){ energy += bandGains[k] * bandGains[k]; }
+    return std::sqrt( energy / jmax( 1, numBands ) );
+}
+
+// true if delay of source image in slot s is ramped (single tap) rather than crossfaded between start and end taps
+bool isDelayRamped( const SourceImageSlots & state, const int s ) const
+{
+    return enableDelayRamping && fabs( state.delaysEnd[s] - state.delaysStart[s] ) * localSampleRate * crossfadeStep <= maxDelayRampRate * localSamplesPerBlockExpected;
+}
+
+// true if source image in slot s is read with a single delay tap at given delay ramp position
+bool isSingleTap( const SourceImageSlots & state, const int s, const float delayRamp ) const
+{
+    return delayRamp >= 1.f || state.delaysStart[s] == state.delaysEnd[s] || isDelayRamped( state, s );
+}
+
+// process a chunk of the source images list in the context of the thread that claimed it (see WorkerPool)
+void processSourceImagesChunk( const int threadId, const int chunkId )
+{
+    int firstImage = chunkId * imagesPerChunk;
+    processSourceImages( firstImage, jmin( firstImage + imagesPerChunk, numSourceImages ), processingContexts[threadId] );
+}
+
+// process source images [firstImage, lastImage[ of the current scene, adding to the buses of context
+void processSourceImages( const int firstImage, const int lastImage, processingContextStruct & context )
+{
+    // delayed source images are band decomposed by groups of FilterBank::numLanes, the ones with flat band
+    // gains (or filtered by their FIR) are processed right away
+    int numLanes = 0;
+    for( int j = firstImage; j < lastImage; j++ )
     {
-        future->directivityGains[j] = directivityHandler.getGains(sourceImageDODs[j](0), sourceImageDODs[j](1));
-        if( filterBank.numOctaveBands == 3 )
+        if( !delaySourceImage( j, numLanes, context ) ){ continue; }
+        if( context.lanes[numLanes].isFlat || current->useFirColoration )
         {
-            future->directivityGains[j] = from10to3bands(future->directivityGains[j]);
+            if( !context.lanes[numLanes].isFlat ){ filterSourceImage( numLanes, context ); }
+            spatializeSourceImage( numLanes, context );
+            continue;
+        }
+        if( ++numLanes == FilterBank::numLanes )
+        {
+            processLanes( numLanes, context );
+            numLanes = 0;
         }
     }
+    if( numLanes > 0 ){ processLanes( numLanes, context ); }
+}
+
+// band decompose the source images delayed in the first numLanes lanes of context at once, then apply room
+// coloration and spatialization to each of them
+void processLanes( const int numLanes, processingContextStruct & context )
+{
+    const float* sources[FilterBank::numLanes];
+    AudioBuffer<float>* destinations[FilterBank::numLanes];
+    FilterBank::FilterState* filterStates[FilterBank::numLanes];
+    for( int lane = 0; lane < FilterBank::numLanes; lane++ )
+    {
+        // unused lanes filter silence
+        if( lane >= numLanes ){ context.workingBuffer.clear( lane, 0, localSamplesPerBlockExpected ); }
+        sources[lane] = context.workingBuffer.getReadPointer( lane );
+        destinations[lane] = &context.bandBuffers[lane];
+        filterStates[lane] = &context.spareFilterStates[lane];
+        if( lane < numLanes )
+        {
+            // filter bank skipped so far: start from cleared filters
+            int s = current->slots[ context.lanes[lane].sourceImage ];
+            filterStates[lane] = &slots->filterStates[s];
+            if( slots->colorationBypassed[s] )
+            {
+                filterStates[lane]->reset();
+                slots->colorationBypassed[s] = 0;
+            }
+        }
+    }
+    filterBank.decomposeBuffers( sources, destinations, filterStates );
+    
+    for( int lane = 0; lane < numLanes; lane++ ){ spatializeSourceImage( lane, context ); }
+}
+
+// filter source image of lane with its FIR (ramped from its start FIR), in place in lane of context working buffer
+void filterSourceImage( const int lane, processingContextStruct & context )
+{
+    int s = current->slots[ context.lanes[lane].sourceImage ];
+    float rampEnd = context.lanes[lane].rampEnd;
+    
+    // FIR skipped so far: start from cleared input history
+    float* history = &slots->firHistories[s*ColorationFIR::firLength];
+    if( slots->colorationBypassed[s] )
+    {
+        std::fill( history, history + ColorationFIR::firLength, 0.f );
+        slots->colorationBypassed[s] = 0;
+    }
+    
+    const std::complex<float>* firSpectrum = &slots->firSpectraTarget[s*ColorationFIR::numBins];
+    if( context.lanes[lane].rampStart < 1.f ){ firSpectrum = context.colorationFIR.getRampedSpectrum( &slots->firSpectraStart[s*ColorationFIR::numBins], firSpectrum, rampEnd ); }
+    context.colorationFIR.process( context.workingBuffer.getWritePointer(lane), localSamplesPerBlockExpected, history, firSpectrum );
+}
+
+// read delayed source image j (delay taps, path length gain and fade in / out level) into lane of context working
+// buffer, get its band gains over the block. Returns false if source image is not to be processed further (removed
+// or culled, faded out).
+// Source images added, removed or modified by a scene update ramp from their parameters at update time to their
+// target ones over 1/crossfadeStep blocks, each with its own ramp position: only those pay for a second delay tap
+// and for the Ambisonic gains ramp, the others are processed with their target parameters.
+bool delaySourceImage( const int j, const int lane, processingContextStruct & context )
+{
+    SceneState & scene = *current;
+    SourceImageSlots & state = *slots;
+    int s = scene.slots[j];
+    AudioBuffer<float> & workingBuffer = context.workingBuffer;
     
-    // update reverb tail (even if not enabled, not cpu demanding and that way it's ready to use)
-    reverbTail.updateInternals( oscHandler.getRT60Values() );
+    // ramp progress over this block
+    float rampStart = state.rampPositions[s];
+    bool isRamping = rampStart < 1.f;
+    float rampEnd = isRamping ? fmin( rampStart + crossfadeStep, 1.f ) : 1.f;
+    state.rampPositions[s] = rampEnd;
     
-    // save (compute) new Ambisonic gains
-    auto sourceImageDOAs = oscHandler.getSourceImageDOAs();
+    // removed or culled source image, faded out (filter bank / FIR state to be reset if it comes back)
+    if( !isRamping && state.levelsTarget[s] == 0.f )
+    {
+        float* ambisonicGainsBlock = &scene.ambisonicGainsBlock[j*N_AMBI_CH];
+        std::fill( ambisonicGainsBlock, ambisonicGainsBlock + N_AMBI_CH, 0.f );
+        ambisonicMatrixEncoder.clearSourceImage(j);
+        state.colorationBypassed[s] = 1;
+        return false;
+    }
     
-    future->ambisonicGains.resize(future->ids.size());
-    for (int i = 0; i < future->ids.size(); i++)
+    // band gains (ramped from their start value): the filter bank / FIR is skipped if they are all equal, bands
+    // adding up to the input
+    auto & laneInfo = context.lanes[lane];
+    laneInfo.sourceImage = j;
+    laneInfo.rampStart = rampStart;
+    laneInfo.rampEnd = rampEnd;
+    laneInfo.isFlat = true;
+    const float* bandGainsStart = &state.bandGainsStart[s*NUM_OCTAVE_BANDS];
+    const float* bandGainsTarget = &state.bandGainsTarget[s*NUM_OCTAVE_BANDS];
+    for( int k = 0; k < scene.numBands; k++ )
     {
-        future->ambisonicGains[i] = ambisonicEncoder.calcParams(sourceImageDOAs[i](0), sourceImageDOAs[i](1));
+        laneInfo.bandGains[k] = isRamping ? getRampValue( bandGainsStart[k], bandGainsTarget[k], rampEnd ) : bandGainsTarget[k];
+        laneInfo.isFlat = laneInfo.isFlat && laneInfo.bandGains[k] == laneInfo.bandGains[0];
     }
+    if( laneInfo.isFlat ){ state.colorationBypassed[s] = 1; }
+    
+    //==========================================================================
+    // GET DELAYED BUFFER, APPLY GAIN BASED ON SOURCE IMAGE PATH LENGTH
     
-    // update binaural encoder (even if not enabled, not cpu demanding and that way it's ready to use)
-    if( current->ids.size() > 0 && directPathId > -1 )
+    // retarget delay taps from their current value, unless crossfading two taps (then done once it is over)
+    float gainTarget = getPathGain( scene.pathLengths[j] );
+    float delayRampStart = state.delayRampPositions[s];
+    if( ( state.delaysEnd[s] != scene.delays[j] || state.gainsEnd[s] != gainTarget ) && isSingleTap( state, s, delayRampStart ) )
     {
-        binauralEncoder.setPosition(sourceImageDOAs[directPathId](0), sourceImageDOAs[directPathId](1));
+        state.delaysStart[s] = getRampValue( state.delaysStart[s], state.delaysEnd[s], delayRampStart );
+        state.gainsStart[s] = getRampValue( state.gainsStart[s], state.gainsEnd[s], delayRampStart );
+        state.delayAllpassStatesStart[s] = state.delayAllpassStates[s];
+        state.delaysEnd[s] = scene.delays[j];
+        state.gainsEnd[s] = gainTarget;
+        delayRampStart = 0.f;
     }
+    float delayRampEnd = fmin( delayRampStart + crossfadeStep, 1.f );
+    state.delayRampPositions[s] = delayRampEnd;
     
-    // update filter bank size
-    filterBank.setNumFilters( filterBank.numOctaveBands, future->ids.size() );
+    // fade in / out level of added / removed source images
+    float levelTarget = state.levelsTarget[s];
+    float levelStart = isRamping ? getRampValue( state.levelsStart[s], levelTarget, rampStart ) : levelTarget;
+    float levelEnd = isRamping ? getRampValue( state.levelsStart[s], levelTarget, rampEnd ) : levelTarget;
     
-    // trigger crossfade mechanism: default
-    crossfadeOver = false;
-    numSourceImages = max(current->ids.size(), future->ids.size());
-    crossfadeGain = 0.0;
+    float* workingData = workingBuffer.getWritePointer(lane);
     
-    // crossfade mechanism: zero image source scenario (make sure MainComponent continues to play unprocessed input)
-    if( future->ids.size() == 0 ){
-        crossfadeGain = 1.0;
-        updateCrossfade();
-        numSourceImages = 0;
+    // single tap: path length gain and level ramped per sample (unless constant, then applied while reading)
+    if( isSingleTap( state, s, delayRampStart ) )
+    {
+        float gainStart = getRampValue( state.gainsStart[s], state.gainsEnd[s], delayRampStart ) * levelStart;
+        float gainEnd = getRampValue( state.gainsStart[s], state.gainsEnd[s], delayRampEnd ) * levelEnd;
+        float gain = ( gainStart != gainEnd ) ? 1.f : gainEnd;
+        
+        // delay unchanged
+        if( delayRampStart >= 1.f || state.delaysStart[s] == state.delaysEnd[s] )
+        {
+            float delay = state.delaysEnd[s] * localSampleRate;
+            blockDelayLine->fillBufferWithDelayedTaps( workingData, 0, &delay, &gain, 1, localSamplesPerBlockExpected, &state.delayAllpassStates[s] );
+        }
+        
+        // ramp delay (Doppler)
+        else
+        {
+            float delayStart = getRampValue( state.delaysStart[s], state.delaysEnd[s], delayRampStart ) * localSampleRate;
+            float delayEnd = getRampValue( state.delaysStart[s], state.delaysEnd[s], delayRampEnd ) * localSampleRate;
+            blockDelayLine->fillBufferWithRampedDelay( workingData, 0, delayStart, delayEnd, gain, localSamplesPerBlockExpected, &state.delayAllpassStates[s] );
+        }
+        
+        if( gainStart != gainEnd ){ workingBuffer.applyGainRamp( lane, 0, localSamplesPerBlockExpected, gainStart, gainEnd ); }
     }
     
+    // otherwise tap start and end delays from delay line, mixed with ramp and path length gains in a single read
+    else
+    {
+        float tapDelays[2] = { state.delaysStart[s] * (float)localSampleRate, state.delaysEnd[s] * (float)localSampleRate };
+        float tapGains[2] = { ( 1.f - delayRampEnd ) * state.gainsStart[s], delayRampEnd * state.gainsEnd[s] };
+        float tapStates[2] = { state.delayAllpassStatesStart[s], state.delayAllpassStates[s] };
+        blockDelayLine->fillBufferWithDelayedTaps( workingData, 0, tapDelays, tapGains, 2, localSamplesPerBlockExpected, tapStates );
+        state.delayAllpassStatesStart[s] = tapStates[0];
+        state.delayAllpassStates[s] = tapStates[1];
+        
+        if( levelStart != levelEnd ){ workingBuffer.applyGainRamp( lane, 0, localSamplesPerBlockExpected, levelStart, levelEnd ); }
+        else if( levelEnd != 1.f ){ workingBuffer.applyGain( lane, 0, localSamplesPerBlockExpected, levelEnd ); }
+    }
+    return true;
 }
-    
-void setFilterBankSize( const unsigned int numFreqBands )
+
+// apply room coloration to source image of lane (band decomposed by processLanes, or in lane of working buffer if
+// filtered by its FIR or if its band gains are flat), output written to ambisonic encoder input (row of source image)
+// and reverb bus, or to binaural output for the direct path
+void spatializeSourceImage( const int lane, processingContextStruct & context )
 {
-    filterBank.setNumFilters( numFreqBands, current->ids.size() );
-    bandBuffer.setSize( numFreqBands, localSamplesPerBlockExpected );
-}
+    SceneState & scene = *current;
+    const int j = context.lanes[lane].sourceImage;
+    const float rampStart = context.lanes[lane].rampStart;
+    const float rampEnd = context.lanes[lane].rampEnd;
+    const bool isRamping = rampStart < 1.f;
+    const bool isFlat = context.lanes[lane].isFlat;
+    const bool isDecomposed = !isFlat && !scene.useFirColoration;
+    const std::array<float, NUM_OCTAVE_BANDS> & bandGains = context.lanes[lane].bandGains;
+    int s = scene.slots[j];
+    AudioBuffer<float> & bandBuffer = context.bandBuffers[lane];
+    float* ambisonicGainsBlock = &scene.ambisonicGainsBlock[j*N_AMBI_CH];
     
-private:
+    //==========================================================================
+    // APPLY FREQUENCY SPECIFIC GAINS (ABSORPTION, DIRECTIVITY)
+    
+    // direct path / early gain
+    bool isDirectPath = scene.directPathId == scene.ids[j];
+    float outputGain = isDirectPath ? directPathGain : earlyGain;
+    bool isBinauralEncoded = enableDirectToBinaural && isDirectPath;
+    
+    // apply band gains and direct path / early gain, recompose (weighted sum of frequency bands) directly in
+    // the ambisonic encoder input. Bands add up to the input: a single gain if they are all equal, none left
+    // to apply once filtered by the FIR
+    int numBands = scene.numBands;
+    float* recomposedData = isBinauralEncoded ? context.scratchBuffer.getWritePointer(0) : ambisonicMatrixEncoder.getSourceImageWritePointer(j);
+    const float* delayedData = context.workingBuffer.getReadPointer(lane);
+    const float gain = isFlat ? bandGains[0] : 1.f;
+    
+    // reverb tail only source image, once faded out of the Ambisonic encoding: no recomposition
+    bool isEncoded = isRamping || slots->levelsOfDetail[s] != LevelOfDetail::ReverbTailOnly;
+    if( !isEncoded ){ ambisonicMatrixEncoder.clearSourceImage(j); }
+    else if( !isDecomposed ){ FloatVectorOperations::copyWithMultiply( recomposedData, delayedData, gain * outputGain, localSamplesPerBlockExpected ); }
+    else
+    {
+        FloatVectorOperations::copyWithMultiply( recomposedData, bandBuffer.getReadPointer(0), bandGains[0] * outputGain, localSamplesPerBlockExpected );
+        for( int k = 1; k < numBands; k++ )
+        {
+            FloatVectorOperations::addWithMultiply( recomposedData, bandBuffer.getReadPointer(k), bandGains[k] * outputGain, localSamplesPerBlockExpected );
+        }
+    }
     
-// update crossfade mechanism (to avoid zipper noise with smooth gains transitions)
-void updateCrossfade()
+    //==========================================================================
+    // AMBISONIC GAINS (encoding itself done for all source images at once, see getNextAudioBlock)
+    
+    const float* ambisonicGainsStart = &slots->ambisonicGainsStart[s*N_AMBI_CH];
+    const float* ambisonicGainsTarget = &slots->ambisonicGainsTarget[s*N_AMBI_CH];
+    for( int k = 0; k < N_AMBI_CH; k++ )
+    {
+        ambisonicGainsBlock[k] = isRamping ? getRampValue( ambisonicGainsStart[k], ambisonicGainsTarget[k], rampStart ) : ambisonicGainsTarget[k];
+    }
+    if( isRamping && !isBinauralEncoded ){ addAmbisonicGainsRamp( j, rampEnd, recomposedData, context ); }
+    
+    //==========================================================================
+    // FEED REVERB TAIL FDN (worker partial bus)
+    if( feedsFdnReverbTail() )
+    {
+        int busId = s % reverbTail.fdnOrder; // by slot: bus kept as other source images come and go
+        
+        // source images not band decomposed are summed per bus, decomposed once per bus (see addBroadbandBusToReverbTail)
+        if( !isDecomposed )
+        {
+            if( !context.hasBroadbandBus )
+            {
+                context.broadbandBusBuffers.clear();
+                context.hasBroadbandBus = true;
+            }
+            context.broadbandBusBuffers.addFrom( busId, 0, delayedData, localSamplesPerBlockExpected, gain );
+        }
+        else
+        {
+            for( int k = 0; k < numBands; k++ )
+            {
+                FloatVectorOperations::multiply( bandBuffer.getWritePointer(k), bandGains[k], localSamplesPerBlockExpected );
+            }
+            ReverbTail::addToBus( context.reverbBusBuffers, busId, bandBuffer, localSamplesPerBlockExpected );
+        }
+    }
+    
+    //==========================================================================
+    // BINAURAL ENCODING (DIRECT PATH ONLY)
+    if( isBinauralEncoded )
+    {
+        // apply filter
+        binauralEncoder.encodeBuffer(context.scratchBuffer, binauralBuffer);
+        
+        // manual loudness normalization (todo: handle this during hrir filter creation)
+        binauralBuffer.applyGain(3.7f);
+        
+        // add to output (stereo channels, not used by other source images)
+        blockAmbisonicBuffer->copyFrom(0, 0, binauralBuffer, 0, 0, localSamplesPerBlockExpected);
+        blockAmbisonicBuffer->copyFrom(1, 0, binauralBuffer, 1, 0, localSamplesPerBlockExpected);
+        
+        // skip remaining (ambisonic encoding)
+        ambisonicMatrixEncoder.clearSourceImage(j);
+    }
+}
+
+// band decompose the summed reverb tail input of source images not band decomposed (one signal per bus, see
+// spatializeSourceImage), add it to the reverb tail buses. Bus filters are run until they are at rest.
+void addBroadbandBusToReverbTail()
 {
-    // either update crossfade
-    if( crossfadeGain < 1.0 )
+    bool hasBroadbandBus = false;
+    for( auto & context : processingContexts ){ hasBroadbandBus = hasBroadbandBus || context.hasBroadbandBus; }
+    if( !hasBroadbandBus )
     {
-        crossfadeGain = fmin( crossfadeGain + crossfadeStep, 1.0 );
+        bool isCleared = true;
+        for( auto & filterState : broadbandBusFilterStates ){ isCleared = isCleared && filterState.isCleared(); }
+        if( isCleared ){ return; }
     }
-    // or stop crossfade mechanism if not already stopped
-    else if (!crossfadeOver)
+    
+    // sum worker buses
+    broadbandBusBuffer.clear();
+    for( auto & context : processingContexts )
     {
-        // set past = future
-        // (objective: atomic swap to make sure no value is updated in middle of audio processing loop)
-        std::swap(current, future);
+        if( !context.hasBroadbandBus ){ continue; }
+        for( int busId = 0; busId < ReverbTail::fdnOrder; busId++ ){ broadbandBusBuffer.addFrom( busId, 0, context.broadbandBusBuffers, busId, 0, localSamplesPerBlockExpected ); }
+    }
+    
+    // decompose by groups of FilterBank::numLanes buses, band buffers of first worker no longer in use
+    std::array<AudioBuffer<float>, FilterBank::numLanes> & bandBuffers = processingContexts[0].bandBuffers;
+    for( int firstBus = 0; firstBus < ReverbTail::fdnOrder; firstBus += FilterBank::numLanes )
+    {
+        const float* sources[FilterBank::numLanes];
+        AudioBuffer<float>* destinations[FilterBank::numLanes];
+        FilterBank::FilterState* filterStates[FilterBank::numLanes];
+        for( int lane = 0; lane < FilterBank::numLanes; lane++ )
+        {
+            sources[lane] = broadbandBusBuffer.getReadPointer( firstBus + lane );
+            destinations[lane] = &bandBuffers[lane];
+            filterStates[lane] = &broadbandBusFilterStates[firstBus + lane];
+        }
+        filterBank.decomposeBuffers( sources, destinations, filterStates );
         
-        // reset crossfade internals
-        crossfadeGain = 1.0; // just to make sure for the last loop using crossfade gain
-        crossfadeOver = true;
+        for( int lane = 0; lane < FilterBank::numLanes; lane++ )
+        {
+            reverbTail.addToBus( firstBus + lane, bandBuffers[lane] );
+        }
+    }
+}
+
+// add Ambisonic gains change of ramping source image j over the block (from gains at block start, encoded by
+// ambisonicMatrixEncoder, to gains at rampEnd, linear per sample) applied to its signal, to the worker ramp buffer
+void addAmbisonicGainsRamp( const int j, const float rampEnd, const float* signal, processingContextStruct & context )
+{
+    int s = current->slots[j];
+    const float* ambisonicGainsStart = &slots->ambisonicGainsStart[s*N_AMBI_CH];
+    const float* ambisonicGainsTarget = &slots->ambisonicGainsTarget[s*N_AMBI_CH];
+    const float* ambisonicGainsBlock = &current->ambisonicGainsBlock[j*N_AMBI_CH];
+    
+    // ramped signal, in scratch buffer
+    float* rampedSignal = context.scratchBuffer.getWritePointer(0);
+    bool isRampComputed = false;
+    
+    for( int k = 0; k < N_AMBI_CH; k++ )
+    {
+        float gainChange = getRampValue( ambisonicGainsStart[k], ambisonicGainsTarget[k], rampEnd ) - ambisonicGainsBlock[k];
+        if( gainChange == 0.f ){ continue; }
+        
+        if( !isRampComputed )
+        {
+            FloatVectorOperations::multiply( rampedSignal, signal, blockRamp.data(), localSamplesPerBlockExpected );
+            isRampComputed = true;
+        }
+        if( !context.hasAmbisonicRamps )
+        {
+            context.ambisonicRampBuffer.clear();
+            context.hasAmbisonicRamps = true;
+        }
+        FloatVectorOperations::addWithMultiply( context.ambisonicRampBuffer.getWritePointer(k), rampedSignal, gainChange, localSamplesPerBlockExpected );
     }
 }
     
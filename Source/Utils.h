@@ -74,6 +74,20 @@ inline int nextPowerOf2( int x )
     return x + 1;
 }
 
+// acc[i] += x[i] * h[i] for numBins complex values (explicit real / imaginary parts,
+// std::complex product is not vectorized)
+inline void complexMultiplyAccumulate( std::complex<float>* acc, const std::complex<float>* x, const std::complex<float>* h, const size_t numBins )
+{
+    float* a = reinterpret_cast<float*>(acc);
+    const float* xf = reinterpret_cast<const float*>(x);
+    const float* hf = reinterpret_cast<const float*>(h);
+    for( size_t i = 0; i < 2 * numBins; i += 2 )
+    {
+        a[i] += xf[i] * hf[i] - xf[i + 1] * hf[i + 1];
+        a[i + 1] += xf[i] * hf[i + 1] + xf[i + 1] * hf[i];
+    }
+}
+
 //==========================================================================
 // MATHS METHODS
 
@@ -0,0 +1,162 @@
+#ifndef WORKERPOOL_H_INCLUDED
+#define WORKERPOOL_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include <atomic>
+#include <functional>
+#if JUCE_INTEL
+ #include <emmintrin.h>
+#endif
+
+// Pool of pre-spawned threads sharing the same job, run once per audio block on numChunks small chunks (one call
+// per chunk id). Chunks are claimed one at a time from an atomic counter by the audio thread and by the workers it
+// wakes up: the audio thread processes every chunk the workers did not claim, then waits for the chunks still being
+// processed. A worker asleep or preempted before claiming delays nothing. A worker preempted while processing still
+// holds up the audio thread until it resumes, but for at most one chunk of work rather than its share of the block.
+// Idle workers spin (yielding) for a short while after each block, then sleep until woken by run (no system call on
+// the audio path while they spin). Workers run at the highest thread priority, as the audio thread.
+class WorkerPool
+{
+
+//==========================================================================
+// ATTRIBUTES
+
+private:
+    
+    class Worker : public Thread
+    {
+    public:
+        
+        Worker( WorkerPool & ownerPool, const int id ):
+        Thread("EvertSE worker " + String(id)),
+        pool(ownerPool),
+        id(id)
+        {}
+        
+        void run() override
+        {
+            int lastBlockId = pool.blockId.load();
+            int64 lastRunTicks = Time::getHighResolutionTicks();
+            while( !threadShouldExit() )
+            {
+                // wait for next block: spin, then sleep (flagged before last check, see WorkerPool::run)
+                int blockId = pool.blockId.load();
+                if( blockId == lastBlockId )
+                {
+                    if( Time::highResolutionTicksToSeconds( Time::getHighResolutionTicks() - lastRunTicks ) < pool.spinDuration ){ Thread::yield(); }
+                    else
+                    {
+                        isSleeping.store( true );
+                        if( pool.blockId.load() == lastBlockId ){ wait(10); }
+                        isSleeping.store( false );
+                    }
+                    continue;
+                }
+                lastBlockId = blockId;
+                
+                // process unclaimed chunks
+                pool.processChunks( id );
+                lastRunTicks = Time::getHighResolutionTicks();
+            }
+        }
+        
+        std::atomic<bool> isSleeping { false };
+    
+    private:
+        
+        WorkerPool & pool;
+        const int id;
+    };
+    
+    OwnedArray<Worker> workers;
+    std::function<void(int, int)> job; // called with id of the calling thread (0: audio thread, in [0, numWorkers[) and chunk id
+    
+    std::atomic<int> blockId { 0 };
+    std::atomic<int64> chunkClaims { 0 }; // number of chunks of the block (high 32 bits), next chunk to claim (low 32 bits)
+    std::atomic<int> numChunksDone { 0 };
+    double spinDuration = 0.0002; // in sec
+
+//==========================================================================
+// METHODS
+
+public:
+
+WorkerPool() {}
+
+~WorkerPool()
+{
+    stop();
+}
+
+// start numWorkers-1 threads (the calling thread is the first worker), not to be called from the audio thread
+void start( const int numWorkers, std::function<void(int, int)> workerJob )
+{
+    stop();
+    job = workerJob;
+    chunkClaims.store(0); // nothing to claim before first run
+    for( int i = 1; i < numWorkers; i++ )
+    {
+        Worker* worker = workers.add( new Worker( *this, i ) );
+        worker->startThread(10); // highest priority, as audio thread
+    }
+}
+
+// stop and delete threads
+void stop()
+{
+    for( int i = 0; i < workers.size(); i++ ){ workers[i]->signalThreadShouldExit(); }
+    for( int i = 0; i < workers.size(); i++ ){ workers[i]->stopThread(1000); }
+    workers.clear();
+}
+
+// number of workers, including calling thread
+int getNumWorkers() const
+{
+    return workers.size() + 1;
+}
+
+// run job on chunks [0, numChunks[ (claimed by the calling thread and the workers), return when all are done
+void run( const int numChunks )
+{
+    // open chunks, wake up sleeping workers
+    numChunksDone.store(0);
+    chunkClaims.store( (int64)numChunks << 32 );
+    blockId.fetch_add(1);
+    for( int i = 0; i < workers.size(); i++ ){ if( workers[i]->isSleeping.load() ){ workers[i]->notify(); } }
+    
+    // calling thread's part: whatever chunks the workers did not claim
+    processChunks(0);
+    
+    // wait for chunks being processed by workers
+    while( numChunksDone.load() < numChunks ){ cpuPause(); }
+}
+
+private:
+
+// claim and process chunks until all are claimed, called by the audio thread and the workers. Chunk id and number of
+// chunks come from the same atomic claim: a worker late from previous block only takes a chunk of the next one by
+// actually claiming it.
+void processChunks( const int threadId )
+{
+    for( int64 claim = chunkClaims.fetch_add(1); (int)( claim & 0xffffffff ) < (int)( claim >> 32 ); claim = chunkClaims.fetch_add(1) )
+    {
+        job( threadId, (int)( claim & 0xffffffff ) );
+        numChunksDone.fetch_add(1);
+    }
+}
+
+// spin wait hint to the CPU (lets the other hyper-thread run, saves power)
+static void cpuPause()
+{
+   #if JUCE_INTEL
+    _mm_pause();
+   #elif JUCE_ARM && ( JUCE_GCC || JUCE_CLANG )
+    __asm__ __volatile__ ("yield");
+   #endif
+}
+
+JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (WorkerPool)
+
+};
+
+#endif // WORKERPOOL_H_INCLUDED